@@ -0,0 +1,337 @@
+/*
+ * Schoku
+ *
+ * A high speed sudoku solver by M. Schulz
+ *
+ * bench/kernels.cpp: microbenchmarks of the solver kernels (make bench)
+ *
+ * The whole-run timings of schoku mix all the algorithms, a change to one of them is
+ * easily lost in the noise of the others.  This program times the kernels one by one
+ * on states captured from a puzzle file:
+ * - the initial states of the puzzles (GridState::initialize)
+ * - the states after the singles, as the cell-major solver reaches them before triads,
+ *   naked sets, fish and guesses (by DigitState::propagate, then GridState::initialize
+ *   with the singles entered).  Puzzles solved by singles alone have no such state.
+ * Each kernel is run over all the states of its kind for at least BENCH_MIN_NS and reported
+ * in ns per call and, if the perf counters can be read, in instructions per cycle.
+ * The algorithms that are inline in solve (hidden singles, triads, naked sets etc.) cannot
+ * be called by themselves: their cycles per call are taken from the phases of solve
+ * (OPT_PHASE_STATS) over the same puzzles, with all the strategies selected.
+ *
+ * Usage:
+ *     schoku_kernels [puzzles] [#]
+ *     [puzzles] names the input file with puzzles, the default is 'puzzles.txt',
+ *     up to # puzzles (default 10000) are used.
+ * The benchmark runs on a single thread, best pinned to a core (e.g. taskset -c 2).
+ */
+#define SCHOKU_LIBRARY
+#define OPT_PHASE_STATS
+#include "../schoku.cpp"
+
+#include <array>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+// the minimum time per kernel
+#define BENCH_MIN_NS 200000000LL
+
+// keeps the results of the kernels from being optimized away
+static volatile unsigned long long sink;
+
+// PerfCounters
+// the cycles and the instructions of this thread (perf_event_open), for the IPC.
+// Not available e.g. in containers or with kernel.perf_event_paranoid > 2,
+// the IPC is not reported then.
+//
+class PerfCounters {
+    int fd[2] = { -1, -1 };
+
+public:
+    PerfCounters() {
+        for (int k = 0; k < 2; k++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = k ? PERF_COUNT_HW_INSTRUCTIONS : PERF_COUNT_HW_CPU_CYCLES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+    }
+
+    ~PerfCounters() {
+        for (int k = 0; k < 2; k++) {
+            if ( fd[k] != -1 ) {
+                close(fd[k]);
+            }
+        }
+    }
+
+    bool available() const {
+        return fd[0] != -1 && fd[1] != -1;
+    }
+
+    void start() {
+        for (int k = 0; k < 2 && available(); k++) {
+            ioctl(fd[k], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd[k], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // the instructions per cycle since start, 0 if not available
+    double stop() {
+        unsigned long long counts[2] = {0, 0};
+        for (int k = 0; k < 2 && available(); k++) {
+            ioctl(fd[k], PERF_EVENT_IOC_DISABLE, 0);
+            if ( read(fd[k], &counts[k], sizeof(counts[k])) != sizeof(counts[k]) ) {
+                return 0;
+            }
+        }
+        return counts[0] ? (double)counts[1]/counts[0] : 0;
+    }
+};
+
+static PerfCounters counters;
+
+// run kernel (calls calls per run) at least BENCH_MIN_NS and report the time per call
+template <typename Kernel>
+void bench(const char *name, size_t calls, Kernel kernel) {
+    if ( calls == 0 ) {
+        printf("%-36s %12s\n", name, "no states");
+        return;
+    }
+    // warm up the caches and the branch predictors
+    kernel();
+    size_t runs = 0;
+    long long ns;
+    counters.start();
+    auto start = std::chrono::steady_clock::now();
+    do {
+        kernel();
+        runs++;
+        ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    } while ( ns < BENCH_MIN_NS );
+    double ipc = counters.stop();
+    if ( ipc ) {
+        printf("%-36s %12ld %10.2lf %6.2lf\n", name, runs*calls, (double)ns/(runs*calls), ipc);
+    } else {
+        printf("%-36s %12ld %10.2lf %6s\n", name, runs*calls, (double)ns/(runs*calls), "-");
+    }
+}
+
+// KernelState
+// a GridState with access to its protected kernels
+//
+class KernelState : public GridState {
+public:
+    inline void enter(unsigned short digit, unsigned char i) {
+        enter_digit<false>(digit, i, 0);
+    }
+};
+
+// the first unlocked cell of state, 81 if none
+inline unsigned char first_unlocked(const GridState &state) {
+    return state.unlocked.u64[0] ? _tzcnt_u64(state.unlocked.u64[0])
+         : state.unlocked.u64[1] ? 64 + _tzcnt_u64(state.unlocked.u64[1]) : 81;
+}
+
+// the kernels with and without pdep/pext, instantiated for the code path of this CPU
+// (bmi2_support) so the dispatch is not timed with them
+template <bool pdep_pext>
+void bench_bit_kernels(const std::vector<GridState> &states) {
+    size_t ns = states.size();
+    KernelState work;
+    bench("get_contiguous_masked_indices_for_box", ns*9, [&] {
+        unsigned int r = 0;
+        for (size_t k = 0; k < ns; k++) {
+            unsigned long long indices[2] = { states[k].unlocked.u64[0], states[k].unlocked.u64[1] };
+            for (int b = 0; b < 9; b++) {
+                r += get_contiguous_masked_indices_for_box<pdep_pext>(indices, b);
+            }
+        }
+        sink += r;
+    });
+    bench("get_digit_planes", ns, [&] {
+        for (size_t k = 0; k < ns; k++) {
+            bit128_t planes[9];
+            get_digit_planes<pdep_pext>(states[k].candidates, states[k].unlocked, planes);
+            sink += planes[k%9].u64[0];
+        }
+    });
+    Stats fish_stats;
+    bench("eliminate_fish (with the copy)", ns, [&] {
+        for (size_t k = 0; k < ns; k++) {
+            memcpy((void *)&work, &states[k], sizeof(GridState));
+            sink += eliminate_fish<false, false, pdep_pext>(work.candidates, work.unlocked, work.updated, 0, fish_stats);
+        }
+    });
+}
+
+int main(int argc, const char *argv[]) {
+    const char *ifn = argc > 1 ? argv[1] : "puzzles.txt";
+    size_t max_puzzles = 10000;
+    if ( argc > 2 ) {
+        sscanf(argv[2], "%ld", &max_puzzles);
+    }
+
+    switch ( schoku_init() ) {
+    case SCHOKU_NO_AVX2:
+        printf("This program requires a CPU with the %s instruction set.\n", SCHOKU_SIMD_NAME);
+        exit(0);
+    case SCHOKU_NO_BMI:
+        printf("This program requires a CPU with the BMI instructions (such as blsr)\n");
+        exit(0);
+    }
+
+    // the puzzles, the lines with less than 81 characters are skipped
+    FILE *f = fopen(ifn, "r");
+    if ( f == 0 ) {
+        fprintf(stderr, "Error: Failed to open file %s: %s\n", ifn, strerror(errno));
+        exit(0);
+    }
+    std::vector<std::array<signed char, 96>> puzzles;
+    char line[256];
+    while ( puzzles.size() < max_puzzles && fgets(line, sizeof(line), f) ) {
+        if ( strlen(line) >= 81 ) {
+            std::array<signed char, 96> p;
+            memcpy(p.data(), line, 81);
+            memset(p.data()+81, 0, 96-81);
+            copy_puzzle(p.data(), p.data());
+            puzzles.push_back(p);
+        }
+    }
+    fclose(f);
+    if ( puzzles.empty() ) {
+        fprintf(stderr, "Error: no puzzles in %s\n", ifn);
+        exit(0);
+    }
+
+    // the captured states
+    std::vector<GridState> states;      // after the singles
+    std::vector<GridState> solutions;   // the solved grids (for verify_solution)
+    Solver solver = get_solver(false, false, default_strategies);
+    Stats capture_stats;
+    schoku_opts opts {};
+    for (size_t k = 0; k < puzzles.size(); k++) {
+        DigitState ds;
+        if ( ds.initialize(puzzles[k].data()) && ds.propagate() && !ds.solved() ) {
+            signed char grid[96];
+            for (unsigned char i = 0; i < 81; i++) {
+                grid[i] = '.';
+                if ( !(ds.unsolved[i/27] & (1 << (i%27))) ) {
+                    for (unsigned char d = 0; d < 9; d++) {
+                        if ( ds.planes[d][i/27] & (1 << (i%27)) ) {
+                            grid[i] = '1' + d;
+                        }
+                    }
+                }
+            }
+            states.emplace_back();
+            states.back().initialize(grid);
+        }
+        signed char grid[96];
+        memcpy(grid, puzzles[k].data(), 96);
+        GridState *stack = get_thread_stack();
+        stack[0].initialize(grid);
+        if ( solver(grid, stack, k+1, opts, capture_stats, 0, 0) ) {
+            solutions.emplace_back();
+            solutions.back().initialize(grid);
+        }
+    }
+
+    printf("schoku kernels version: %s\ncompile options: %s\n", version_string, compilation_options);
+    printf("%ld puzzles from %s, %ld states after the singles, %s code path%s%s\n\n", puzzles.size(), ifn, states.size(), SCHOKU_SIMD_NAME,
+           bmi2_support ? " with pdep/pext" : "", avx512_support ? " (the phases of solve with AVX-512)" : "");
+    printf("%-36s %12s %10s %6s\n", "kernel", "calls", "ns/call", "IPC");
+
+    size_t np = puzzles.size();
+    size_t ns = states.size();
+    KernelState work;
+
+    bench("GridState::initialize", np, [&] {
+        for (size_t k = 0; k < np; k++) {
+            signed char grid[96];
+            memcpy(grid, puzzles[k].data(), 96);
+            sink += work.initialize(grid);
+        }
+    });
+    bench("GridState copy", ns, [&] {
+        for (size_t k = 0; k < ns; k++) {
+            memcpy((void *)&work, &states[k], sizeof(GridState));
+            sink += work.candidates[k%81];
+        }
+    });
+    bench("enter_digit (with the copy)", ns, [&] {
+        for (size_t k = 0; k < ns; k++) {
+            memcpy((void *)&work, &states[k], sizeof(GridState));
+            unsigned char i = first_unlocked(work);
+            if ( i < 81 ) {
+                work.enter(work.candidates[i] & -work.candidates[i], i);
+            }
+            sink += work.candidates[k%81];
+        }
+    });
+    if ( bmi2_support ) {
+        bench_bit_kernels<true>(states);
+    } else {
+        bench_bit_kernels<false>(states);
+    }
+    bench("DigitState initialize and propagate", np, [&] {
+        for (size_t k = 0; k < np; k++) {
+            DigitState ds;
+            sink += ds.initialize(puzzles[k].data()) && ds.propagate();
+        }
+    });
+    bench("verify_solution", solutions.size(), [&] {
+        for (size_t k = 0; k < solutions.size(); k++) {
+            sink += verify_solution(solutions[k].candidates);
+        }
+    });
+    bench("solve (the whole puzzle)", np, [&] {
+        Stats stats;
+        for (size_t k = 0; k < np; k++) {
+            signed char grid[96];
+            memcpy(grid, puzzles[k].data(), 96);
+            GridState *stack = get_thread_stack();
+            stack[0].initialize(grid);
+            sink += solver(grid, stack, k+1, opts, stats, 0, 0);
+        }
+    });
+
+    // the phases of solve, with the TSC rate for the ns per call
+    // (the verbose solve, which also collects the statistics, is a little slower).
+    // All the strategies are selected, so triads, naked sets and fish have their phases
+    // whatever the compiled default strategies.
+    const int phase_strategies = SCHOKU_STRATEGY_SELECTED | SCHOKU_STRATEGY_TRIAD_RES | SCHOKU_STRATEGY_SETS | SCHOKU_STRATEGY_FISH;
+    Solver verbose_solver = get_solver(true, avx512_support, phase_strategies);
+    schoku_opts verbose_opts {};
+    verbose_opts.reportstats = 1;
+    verbose_opts.strategies = phase_strategies;
+    Stats stats;
+    long long duration;
+    unsigned long long tsc_start = __rdtsc();
+    auto start = std::chrono::steady_clock::now();
+    do {
+        for (size_t k = 0; k < np; k++) {
+            signed char grid[96];
+            memcpy(grid, puzzles[k].data(), 96);
+            GridState *stack = get_thread_stack();
+            stack[0].initialize(grid);
+            verbose_solver(grid, stack, k+1, verbose_opts, stats, 0, 0);
+        }
+        duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    } while ( duration < BENCH_MIN_NS );
+    double tsc_per_ns = (double)(__rdtsc() - tsc_start)/duration;
+
+    printf("\n%-14s %16s %13s %8s   (all strategies)\n", "phase of solve", "calls", "cycles/call", "ns/call");
+    for (int p = 0; p < Phases; p++) {
+        const unsigned long long *calls = stats.phases.calls[p];
+        unsigned long long total = calls[PhaseProgress] + calls[PhaseNoProgress] + calls[PhaseBack];
+        double cycles = total ? (double)stats.phases.cycles[p]/total : 0.0;
+        printf("%-14s %16lld %13.1lf %8.2lf\n", phase_names[p], total, cycles, cycles/tsc_per_ns);
+    }
+    return 0;
+}
@@ -25,7 +25,7 @@
  * compile options:
  *     49151  puzzles entered
  *     49151  1927853/s  puzzles solved
- *    25.5ms    0.52s/puzzle  solving time
+ *    25.5ms    0.52µs/puzzle  solving time
  *     37834   76.98%  puzzles solved without guessing
  *     30798    0.63/puzzle  guesses
  *     20996    0.43/puzzle  back tracks
@@ -38,7 +38,7 @@
  * compile options: OPT_TRIAD_RES OPT_SETS
  *     49151  puzzles entered
  *     49151  1776720/s  puzzles solved
- *    27.7ms    0.56s/puzzle  solving time
+ *    27.7ms    0.56µs/puzzle  solving time
  *     42086   85.63%  puzzles solved without guessing
  *     12406    0.25/puzzle  guesses
  *      7446    0.15/puzzle  back tracks
@@ -53,6 +53,11 @@
  */
 #include <atomic>
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
@@ -61,15 +66,29 @@
 #include <fcntl.h>
 #include <omp.h>
 #include <stdbool.h>
-#include <intrin.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <string>
+
+#include "schoku.h"
+#include "simd.h"
 
 const char *version_string = "0.8";
 
 const char *compilation_options = 
 // Options OPT_SETS and OPT_TRIAD_RES compete to some degree, but they also perform well
 // together for excellent statistics.
+// These are the default strategies, -e selects the strategies at run time.
 #ifdef OPT_TRIAD_RES
 // Triad resolution examines all triads and if exactly three candidates are present
 // marks them as sets. A small penalty to speed but a boost to statistics overall.
@@ -82,6 +101,16 @@ const char *compilation_options =
 //
 "OPT_SETS "
 #endif
+#ifdef OPT_FISH
+// X-Wings and Swordfish are searched for on the digit planes before a guess is made.
+//
+"OPT_FISH "
+#endif
+#ifdef OPT_PHASE_STATS
+// Count the cycles and the outcomes of the phases of solve (printed with -x).
+//
+"OPT_PHASE_STATS "
+#endif
 ""
 ;
 
@@ -457,33 +486,246 @@ const char * cl2txt[81] = {
     };
 align64_empty c9;
 
+// use pdep/pext (BMI2): these are slow on AMD Zen2 (microcoded).
+// Only selects the instantiation of solve (see get_solver), the kernels take it as the template parameter bmi2.
 bool bmi2_support = false;
 
-// stats and command line options
-int reportstats     = 0; // collect and report some statistics
-int verify          = 0; // verify solution correctness (implied otherwise)
-int unique_check    = 0; // check solution uniqueness
-int debug           = 0; // provide step by step output on the solution
-int thorough_check  = 0; // check for back tracking even if no guess was made.
-int numthreads      = 0; // if not 0, number of threads
-
-signed char *output;
-
-std::atomic<long> solved_count(0);          // puzzles solved
-std::atomic<long> unsolved_count(0);        // puzzles unsolved (no solution exists)
-std::atomic<long> non_unique_count(0);      // puzzles not unique (with -u)
-std::atomic<long> not_verified_count(0);    // puzzles non verified (with -v)
-std::atomic<long> verified_count(0);        // puzzles successfully verified (with -v)
-std::atomic<long> bug_count(0);             // universal grave detected
-std::atomic<long long> guesses(0);          // how many guesses did it take
-std::atomic<long long> trackbacks(0);       // how often did we back track
-std::atomic<long> no_guess_cnt(0);          // how many puzzles were solved without guessing
-std::atomic<long long> past_naked_count(0); // how often do we get past the naked single serach
-std::atomic<long long> naked_sets_searched(0); // how many naked sets did we search for
-std::atomic<long long> naked_sets_found(0); // how many naked sets did we actually find
-std::atomic<long long> digits_entered_and_retracted(0); // to measure guessing overhead
-std::atomic<long> triads_resolved(0);       // how many triads did we resolved
-std::atomic<long> triad_updates(0);         // how many triads did cancel candidates
+#ifdef OPT_PHASE_STATS
+// PhaseStats
+// where solve spends its time: the cycles (rdtsc) and the invocations per phase,
+// the latter by the outcome of the phase.  Only collected with verbose (-x or -d).
+// A phase ends when the next one begins: with progress when a digit is entered (goto enter/start),
+// with a back track (goto back) or without progress when the next algorithm is tried.
+//
+enum Phase { PhaseNakedSingle, PhaseHiddenSingle, PhaseTriads, PhaseNakedSets, PhaseBUG, PhaseFish, PhaseProbe, PhaseGuess, PhaseBackTrack, Phases };
+enum PhaseOutcome { PhaseProgress, PhaseNoProgress, PhaseBack, PhaseOutcomes };
+
+const char *phase_names[Phases] = {
+    "naked singles", "hidden singles", "triads", "naked sets", "bi-value grave", "fish", "probe", "guess", "back track" };
+
+struct PhaseStats {
+    unsigned long long calls[Phases][PhaseOutcomes] = {{0}};
+    unsigned long long cycles[Phases] = {0};
+
+    void add(const PhaseStats &o) {
+        for (int p = 0; p < Phases; p++) {
+            for (int k = 0; k < PhaseOutcomes; k++) {
+                calls[p][k] += o.calls[p][k];
+            }
+            cycles[p] += o.cycles[p];
+        }
+    }
+};
+
+// PhaseClock
+// the current phase of a solve and when it began.
+//
+class PhaseClock {
+    PhaseStats &ps;
+    int phase = Phases;    // none
+    unsigned long long start = 0;
+
+public:
+    PhaseClock(PhaseStats &ps_) : ps(ps_) {}
+
+    // end the current phase with the outcome and begin phase p (Phases for none)
+    inline void next(int p, int outcome) {
+        unsigned long long now = __rdtsc();
+        if ( phase != Phases ) {
+            ps.cycles[phase] += now - start;
+            ps.calls[phase][outcome]++;
+        }
+        phase = p;
+        start = now;
+    }
+};
+
+#define PHASE_NEXT(p, outcome) if ( verbose ) phase_clock.next(p, outcome)
+#else
+#define PHASE_NEXT(p, outcome)
+#endif
+
+// the combinations of the strategies SCHOKU_STRATEGY_TRIAD_RES, SCHOKU_STRATEGY_SETS and SCHOKU_STRATEGY_FISH
+#define STRATEGY_COMBINATIONS 8
+#define STRATEGY_MASK         (STRATEGY_COMBINATIONS-1)
+
+// Stats
+// the statistics of one thread (or, once reduced, of one batch).
+// See schoku_stats for the meaning of the counters.
+// Each thread accumulates into its own Stats block, which is reduced once
+// after the thread's share of the parallel loop is done.
+// The alignment keeps the blocks of different threads on separate cache lines.
+//
+struct alignas(64) Stats {
+    long      solved_count = 0;
+    long      unsolved_count = 0;
+    long      non_unique_count = 0;
+    long      not_verified_count = 0;
+    long      verified_count = 0;
+    long      bug_count = 0;
+    long long guesses = 0;
+    long long trackbacks = 0;
+    long      no_guess_cnt = 0;
+    long long past_naked_count = 0;
+    long long naked_sets_searched = 0;
+    long long naked_sets_found = 0;
+    long long digits_entered_and_retracted = 0;
+    long      triads_resolved = 0;
+    long      triad_updates = 0;
+    long      cache_hits = 0;
+    long      fish_found = 0;
+    long      fish_removed = 0;
+    long      probes = 0;
+    long      probe_removed = 0;
+    long      limit_count = 0;
+    long      steals = 0;
+    long      strategy_count[STRATEGY_COMBINATIONS] = {0};   // puzzles solved per combination of strategies
+#ifdef OPT_PHASE_STATS
+    PhaseStats phases;
+#endif
+
+    void add(const Stats &o) {
+        solved_count                 += o.solved_count;
+        unsolved_count               += o.unsolved_count;
+        non_unique_count             += o.non_unique_count;
+        not_verified_count           += o.not_verified_count;
+        verified_count               += o.verified_count;
+        bug_count                    += o.bug_count;
+        guesses                      += o.guesses;
+        trackbacks                   += o.trackbacks;
+        no_guess_cnt                 += o.no_guess_cnt;
+        past_naked_count             += o.past_naked_count;
+        naked_sets_searched          += o.naked_sets_searched;
+        naked_sets_found             += o.naked_sets_found;
+        digits_entered_and_retracted += o.digits_entered_and_retracted;
+        triads_resolved              += o.triads_resolved;
+        triad_updates                += o.triad_updates;
+        cache_hits                   += o.cache_hits;
+        fish_found                   += o.fish_found;
+        fish_removed                 += o.fish_removed;
+        probes                       += o.probes;
+        probe_removed                += o.probe_removed;
+        limit_count                  += o.limit_count;
+        steals                       += o.steals;
+        for (int s = 0; s < STRATEGY_COMBINATIONS; s++) {
+            strategy_count[s]        += o.strategy_count[s];
+        }
+#ifdef OPT_PHASE_STATS
+        phases.add(o.phases);
+#endif
+    }
+
+    void copy_to(schoku_stats *s) const {
+        s->solved_count                 = solved_count;
+        s->unsolved_count               = unsolved_count;
+        s->non_unique_count             = non_unique_count;
+        s->not_verified_count           = not_verified_count;
+        s->verified_count               = verified_count;
+        s->bug_count                    = bug_count;
+        s->guesses                      = guesses;
+        s->trackbacks                   = trackbacks;
+        s->no_guess_cnt                 = no_guess_cnt;
+        s->past_naked_count             = past_naked_count;
+        s->naked_sets_searched          = naked_sets_searched;
+        s->naked_sets_found             = naked_sets_found;
+        s->digits_entered_and_retracted = digits_entered_and_retracted;
+        s->triads_resolved              = triads_resolved;
+        s->triad_updates                = triad_updates;
+        s->cache_hits                   = cache_hits;
+        s->fish_found                   = fish_found;
+        s->fish_removed                 = fish_removed;
+        s->probes                       = probes;
+        s->probe_removed                = probe_removed;
+        s->limit_count                  = limit_count;
+        s->steals                       = steals;
+    }
+};
+
+// Latency
+// the solving times of puzzles for the benchmark mode (-b).
+// A histogram with 32 buckets per power of two (within 3%), the exact maximum and
+// the slowest lines.  Like Stats, each thread fills its own and these are added up.
+//
+#define LATENCY_SUB_BITS 5
+#define LATENCY_BUCKETS  (60<<LATENCY_SUB_BITS)
+#define LATENCY_SLOWEST  10
+
+struct Latency {
+    unsigned long long count = 0;
+    unsigned long long total = 0;                 // ns
+    unsigned long long bucket[LATENCY_BUCKETS] = {0};
+    unsigned long long slowest_ns[LATENCY_SLOWEST] = {0}; // descending
+    size_t slowest_line[LATENCY_SLOWEST] = {0};
+
+    static unsigned int bucket_of(unsigned long long ns) {
+        if ( ns < (2<<LATENCY_SUB_BITS) ) {
+            return ns;
+        }
+        unsigned int e = 63 - _lzcnt_u64(ns);
+        return ((e-LATENCY_SUB_BITS+1) << LATENCY_SUB_BITS) + (ns >> (e-LATENCY_SUB_BITS)) - (1<<LATENCY_SUB_BITS);
+    }
+
+    // the smallest value of a bucket
+    static unsigned long long value_of(unsigned int b) {
+        if ( b < (2<<LATENCY_SUB_BITS) ) {
+            return b;
+        }
+        unsigned int e = (b >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+        return (unsigned long long)((b & ((1<<LATENCY_SUB_BITS)-1)) + (1<<LATENCY_SUB_BITS)) << (e-LATENCY_SUB_BITS);
+    }
+
+    void add_slow(size_t line, unsigned long long ns) {
+        if ( ns <= slowest_ns[LATENCY_SLOWEST-1] ) {
+            return;
+        }
+        // the same line from another iteration is kept once, with its slowest time
+        int k;
+        for (k = 0; k < LATENCY_SLOWEST-1 && slowest_line[k] != line; k++);
+        if ( slowest_line[k] == line && slowest_ns[k] >= ns ) {
+            return;
+        }
+        for (; k > 0 && slowest_ns[k-1] < ns; k--) {
+            slowest_ns[k] = slowest_ns[k-1];
+            slowest_line[k] = slowest_line[k-1];
+        }
+        slowest_ns[k] = ns;
+        slowest_line[k] = line;
+    }
+
+    void record(size_t line, unsigned long long ns) {
+        count++;
+        total += ns;
+        bucket[bucket_of(ns)]++;
+        add_slow(line, ns);
+    }
+
+    void add(const Latency &o) {
+        count += o.count;
+        total += o.total;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            bucket[b] += o.bucket[b];
+        }
+        for (int k = 0; k < LATENCY_SLOWEST && o.slowest_ns[k]; k++) {
+            add_slow(o.slowest_line[k], o.slowest_ns[k]);
+        }
+    }
+
+    // the latency at percentile p (0-100)
+    unsigned long long percentile(double p) const {
+        unsigned long long rank = (unsigned long long)(p/100*count);
+        if ( rank >= count ) {
+            return slowest_ns[0];
+        }
+        unsigned long long seen = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            seen += bucket[b];
+            if ( seen > rank ) {
+                return value_of(b);
+            }
+        }
+        return slowest_ns[0];
+    }
+};
 
 inline unsigned char tzcnt_and_mask(unsigned long long &mask) {
     unsigned char ret = _tzcnt_u64(mask);
@@ -496,24 +738,24 @@ inline __m256i expand_bitvector(unsigned short m) {
     return _mm256_cmpeq_epi16(_mm256_and_si256( bit_mask,_mm256_set1_epi16(m)), bit_mask);
 }
 
-template<bool doubledbits=false>
+template<bool doubledbits, bool bmi2>
 inline __attribute__((always_inline)) unsigned short compress_epi16_boolean128(__m128i b) {
     if (doubledbits) {
         return _mm_movemask_epi8(b);
     }
-    if ( bmi2_support ) {
+    if constexpr ( bmi2 ) {
         return _pext_u32(_mm_movemask_epi8(b), 0x5555);
     } else {
         return _mm_movemask_epi8(_mm_packs_epi16(b, _mm_setzero_si128()));
     }
 }
 
-template<bool doubledbits=false>
+template<bool doubledbits, bool bmi2>
 inline __attribute__((always_inline)) unsigned int compress_epi16_boolean(__m256i b) {
     if (doubledbits) {
         return _mm256_movemask_epi8(b);
     }
-    if ( bmi2_support ) {
+    if constexpr ( bmi2 ) {
         return _pext_u32(_mm256_movemask_epi8(b),0x55555555);
     } else {
         return _mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(b), _mm256_extractf128_si256(b,1)));
@@ -551,13 +793,15 @@ inline __attribute__((always_inline))__m256i andnot_if(__m256i a, __m256i b, __m
 // 2. expand the compressed boolean, and then compress again to 1 or 2 bits
 //    using template parameter doubledbits.
 //    (the old way, pure AVX/AVX2)
+// The pathway is selected at compile time by the template parameter bmi2,
+// there is an instantiation of solve for each (see get_solver).
 //
 
-template<bool doubledbits=false>
+template<bool doubledbits, bool bmi2>
 inline __attribute__((always_inline)) unsigned int and_compress_masks(__m256i a, unsigned short b) {
-    if ( bmi2_support ) {
+    if constexpr ( bmi2 ) {
 // path 1:
-    unsigned int res = compress_epi16_boolean<doubledbits>(a);
+    unsigned int res = compress_epi16_boolean<doubledbits, bmi2>(a);
         if (doubledbits) {
             return res & _pdep_u32(b,0x55555555);
         } else {
@@ -565,12 +809,13 @@ inline __attribute__((always_inline)) unsigned int and_compress_masks(__m256i a,
         }
     } else {
 // path 2:
-        return compress_epi16_boolean<doubledbits>(_mm256_and_si256(a, expand_bitvector(b)));
+        return compress_epi16_boolean<doubledbits, bmi2>(_mm256_and_si256(a, expand_bitvector(b)));
     }
 }
 
 // for the 9 cells of a box (given by the index of the box),
 // return the corresponding masking bits as a contiguous bit vector
+template<bool bmi2>
 inline unsigned int get_contiguous_masked_indices_for_box(unsigned long long indices[2], int boxi) {
 
     // step 1, and-combine the indices with const bitmask for the box
@@ -584,7 +829,7 @@ inline unsigned int get_contiguous_masked_indices_for_box(unsigned long long ind
 
     // step 3, combine the 21 given bits (0b111000000111000000111)
     // into contiguous 9 bits for the given box
-    if ( bmi2_support ) {
+    if constexpr ( bmi2 ) {
         const unsigned int mask21 = (0x7<<18)|(0x7<<9)|0x7;
         return _pext_u32(mask,mask21);
     } else {
@@ -667,6 +912,90 @@ public:
 // 
 #define	GRIDSTATE_MAX 28
 
+// TrailEntry and Trail
+// In trail mode (-r) the GridState is not copied to a new stack level for a guess.
+// Instead, the parts of the GridState that can still change are saved to a per-thread
+// trail before the guess is entered, and restored from it when back tracking.
+// Only the groups of 16 cells that contain unlocked cells are saved,
+// so the trail entries get smaller as the puzzle progresses.
+// The trail grows as needed, there is no limit on the levels of guesses.
+//
+class __attribute__ ((aligned(16))) TrailEntry
+{
+public:
+    bit128_t unlocked;
+    bit128_t updated;
+    bit128_t set23_found[3];
+    unsigned int triads_unlocked[2];
+    unsigned int prev;                // offset of the previous entry in the trail
+    short stackpointer;
+    unsigned short candidate80;       // the candidates of cell 80
+    unsigned short patch_mask;        // the candidate to remove on back tracking
+    unsigned char patch_cells[3];     // from these cells
+    unsigned char patch_cnt;
+    unsigned char groups;             // bit g set: the candidates of cells 16*g - 16*g+15 follow
+};
+
+class Trail
+{
+    unsigned char *buf = 0;
+    size_t cap  = 0;
+    size_t end  = 0;                  // size in use
+    size_t last = 0;                  // offset of the top entry
+
+    // move the entries to fresh pages of the given size, placed by the first touch of this thread
+    void remap(size_t size) {
+        void *p = mmap((void*)0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if ( p == MAP_FAILED ) {
+            fprintf(stderr, "Error: out of memory for the trail\n");
+            exit(1);
+        }
+        memset(p, 0, size);
+        if ( buf ) {
+            memcpy(p, buf, end);
+            munmap(buf, cap);
+        }
+        buf = (unsigned char *)p;
+        cap = size;
+    }
+public:
+    inline void clear() {
+        end = 0;
+    }
+    // the thread was bound to another NUMA node (see set_thread_stack_node)
+    void rehome() {
+        if ( buf ) {
+            remap(cap);
+        }
+    }
+    inline TrailEntry *top() {
+        return (TrailEntry *)&buf[last];
+    }
+    // add an entry of the given size (a multiple of 16)
+    inline TrailEntry *push(size_t size) {
+        if ( end + size > cap ) {
+            remap(cap ? 2*cap : 0x4000);
+        }
+        TrailEntry *e = (TrailEntry *)&buf[end];
+        e->prev = last;
+        last = end;
+        end += size;
+        return e;
+    }
+    inline void pop() {
+        end  = last;
+        last = top()->prev;
+    }
+};
+
+// The trail of each thread is kept for the life of the thread.
+static thread_local Trail thread_trail;
+
+inline Trail *get_thread_trail() {
+    return &thread_trail;
+}
+
+
 // GridState encapsulates the current state of the solver, specifically for the
 // purpose of guessing and back tracking.
 //
@@ -681,59 +1010,173 @@ public:
     unsigned short candidates[81];    // which digits can go in this cell? Set bits correspond to possible digits
     short stackpointer;               // this-1 == last grid state before a guess was made, used for backtracking
     unsigned int triads_unlocked[2];  // unlocked row and col triads (#candidates >3), 27 bits each
-    unsigned int filler[1];           // align on 16 bytes
+    unsigned int given_away;          // parallel search: the back tracking branch is searched by another thread
     bit128_t unlocked;                // for keeping track of which cells don't need to be looked at anymore. Set bits correspond to cells that still have multiple possibilities
     bit128_t updated;                 // for keeping track of which cell's candidates may have been changed since last time we looked for naked sets. Set bits correspond to changed candidates in these cells
     bit128_t set23_found[3];          // for keeping track of found sets of size 2 and 3
 
 // GridState is normally copied for recursion
 // Here we initialize the starting state including the puzzle.
+// Returns false if the clues conflict (a digit twice in a row, column or box).
 //
-inline void initialize(signed char grid[81]) {
-    // 0x1ffffffffffffffffffffULLL is (0x1ULL << 81) - 1
-    unlocked.u128 = (((__uint128_t)1)<<81)-1;
+// The clues are converted to their digit bits 16 cells at a time: a shuffle looks up the
+// low and the high byte of the bit of each digit, and a second pair of shuffles spreads
+// the bytes into the 16-bit cells (the low 128-bit lane takes cells 0-7, the high lane 8-15).
+// The unions of the rows, columns and boxes are taken over the clues only, a clue that
+// is in the union already is a conflict.  The unions are then looked up per cell by
+// shuffles of their low and high bytes indexed by row_index, column_index and box_index.
+//
+inline bool initialize(signed char grid[81]) {
+    const __m256i low_bits   = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i high_bits  = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0,
+                                                0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i spread_low  = _mm256_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 4, -1, 5, -1, 6, -1, 7, -1,
+                                                 8, -1, 9, -1, 10, -1, 11, -1, 12, -1, 13, -1, 14, -1, 15, -1);
+    const __m256i spread_high = _mm256_setr_epi8(-1, 0, -1, 1, -1, 2, -1, 3, -1, 4, -1, 5, -1, 6, -1, 7,
+                                                 -1, 8, -1, 9, -1, 10, -1, 11, -1, 12, -1, 13, -1, 14, -1, 15);
+    const __m256i all_digits = _mm256_set1_epi16(0x1ff);
+
+    // the digit bits of the clues, 0 otherwise
+    __m256i clues[5];
+    unsigned long long clue_mask[2] = {0, 0};
+    for (unsigned char g = 0; g < 5; g++) {
+        __m128i c16 = _mm_loadu_si128((const __m128i *) &grid[g<<4]);
+        __m256i c = _mm256_set_m128i(c16, c16);
+        __m256i is_clue = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0')), _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), c));
+        __m256i d = _mm256_add_epi8(c, _mm256_set1_epi8(-'1'));
+        __m256i lo = _mm256_and_si256(_mm256_shuffle_epi8(low_bits, d), is_clue);
+        __m256i hi = _mm256_and_si256(_mm256_shuffle_epi8(high_bits, d), is_clue);
+        clues[g] = _mm256_or_si256(_mm256_shuffle_epi8(lo, spread_low), _mm256_shuffle_epi8(hi, spread_high));
+        clue_mask[g>>2] |= (unsigned long long)(_mm256_movemask_epi8(is_clue) & 0xffff) << ((g&3)<<4);
+    }
+    unsigned short clue80 = grid[80] > '0' && grid[80] <= '9' ? 1 << (grid[80]-'1') : 0;
+    clue_mask[1] |= (unsigned long long)(clue80 != 0) << 16;
+    _mm256_store_si256((__m256i *) &candidates[0], clues[0]);
+    _mm256_store_si256((__m256i *) &candidates[16], clues[1]);
+    _mm256_store_si256((__m256i *) &candidates[32], clues[2]);
+    _mm256_store_si256((__m256i *) &candidates[48], clues[3]);
+    _mm256_store_si256((__m256i *) &candidates[64], clues[4]);
+    candidates[80] = clue80;
+
+    // the unions of the clues, in bytes for the shuffles below
+    unsigned short units[3][9] = {{0}};
+    bool ok = true;
+    for (unsigned char w = 0; w < 2; w++) {
+        for (unsigned long long m = clue_mask[w]; m; m = _blsr_u64(m)) {
+            unsigned char i = (w<<6) + _tzcnt_u64(m);
+            unsigned short digit = candidates[i];
+            unsigned short &row = units[Row][row_index[i]];
+            unsigned short &col = units[Col][column_index[i]];
+            unsigned short &box = units[Box][box_index[i]];
+            ok &= ((row | col | box) & digit) == 0;
+            row |= digit;
+            col |= digit;
+            box |= digit;
+        }
+    }
+    __m256i unit_low[3], unit_high[3];
+    for (unsigned char k = 0; k < 3; k++) {
+        unsigned char low[16] = {0}, high[16] = {0};
+        for (unsigned char u = 0; u < 9; u++) {
+            low[u]  = units[k][u];
+            high[u] = units[k][u] >> 8;
+        }
+        __m128i l = _mm_loadu_si128((const __m128i *) low);
+        __m128i h = _mm_loadu_si128((const __m128i *) high);
+        unit_low[k]  = _mm256_set_m128i(l, l);
+        unit_high[k] = _mm256_set_m128i(h, h);
+    }
+
+    // the candidates of the cells without a clue
+    for (unsigned char g = 0; g < 5; g++) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        for (unsigned char k = 0; k < 3; k++) {
+            __m128i i16 = _mm_loadu_si128((const __m128i *) &index_by_kind[k][g<<4]);
+            __m256i index = _mm256_set_m128i(i16, i16);
+            lo = _mm256_or_si256(lo, _mm256_shuffle_epi8(unit_low[k], index));
+            hi = _mm256_or_si256(hi, _mm256_shuffle_epi8(unit_high[k], index));
+        }
+        __m256i used = _mm256_or_si256(_mm256_shuffle_epi8(lo, spread_low), _mm256_shuffle_epi8(hi, spread_high));
+        __m256i no_clue = _mm256_cmpeq_epi16(clues[g], _mm256_setzero_si256());
+        _mm256_store_si256((__m256i *) &candidates[g<<4],
+            _mm256_or_si256(clues[g], _mm256_and_si256(no_clue, _mm256_andnot_si256(used, all_digits))));
+    }
+    if ( clue80 == 0 ) {
+        candidates[80] = 0x01ff ^ (units[Row][row_index[80]] | units[Col][column_index[80]] | units[Box][box_index[80]]);
+    }
+
+    unlocked.u64[0] = ~clue_mask[0];
+    unlocked.u64[1] = ~clue_mask[1] & 0x1ffff;
     updated.u128  = (((__uint128_t)1)<<81)-1;
 
     triads_unlocked[0] = triads_unlocked[1] = 0x1ffLL | (0x1ffLL<<10) | (0x1ffLL<<20);
     set23_found[0] = set23_found[1] = set23_found[2] = {__int128 {0}};
 
     stackpointer = 0;
+    given_away = 0;
 
-    signed short digit;
-    unsigned short columns[9] = {0};
-    unsigned short rows[9]    = {0};
-    unsigned short boxes[9]   = {0};
+    return ok;
+}
 
-        for (unsigned char i = 0; i < 64; ++i) {
-            digit = grid[i] - 49;
-            if (digit >= 0) {
-                digit = 1 << digit;
-                columns[column_index[i]] |= digit;
-                rows[row_index[i]]       |= digit;
-                boxes[box_index[i]]      |= digit;
-                _bittestandreset64((long long int *)unlocked.u64, i);
-            }
+// Trail mode:
+// save the current state to the trail, including the cells in 'save' (and the unlocked cells).
+// The caller adds the candidate to remove on back tracking to the returned entry.
+//
+inline TrailEntry *save_to_trail(Trail &trail, bit128_t save) {
+    save.u128 |= unlocked.u128;
+    unsigned char groups = 0;
+    for (unsigned char g = 0; g < 5; g++) {
+        if ( save.u16[g] ) {
+            groups |= 1<<g;
         }
-
-        for (unsigned char i = 64; i < 81; ++i) {
-            digit = grid[i] - 49;
-            if (digit >= 0) {
-                digit = 1 << digit;
-                columns[column_index[i]] |= digit;
-                rows[row_index[i]]       |= digit;
-                boxes[box_index[i]]      |= digit;
-                _bittestandreset64((long long int *)&unlocked.u64[1], i-64);
-            }
+    }
+    TrailEntry *e = trail.push(sizeof(TrailEntry) + _popcnt32(groups)*32);
+    e->unlocked           = unlocked;
+    e->updated            = updated;
+    e->set23_found[0]     = set23_found[0];
+    e->set23_found[1]     = set23_found[1];
+    e->set23_found[2]     = set23_found[2];
+    e->triads_unlocked[0] = triads_unlocked[0];
+    e->triads_unlocked[1] = triads_unlocked[1];
+    e->stackpointer       = stackpointer;
+    e->candidate80        = candidates[80];
+    e->patch_cnt          = 0;
+    e->groups             = groups;
+    __m256i *c = (__m256i *)(e+1);
+    for (unsigned char g = 0; g < 5; g++) {
+        if ( groups & (1<<g) ) {
+            _mm256_storeu_si256(c++, _mm256_load_si256((__m256i*) &candidates[g<<4]));
         }
+    }
+    return e;
+}
 
-    for (unsigned char i = 0; i < 81; ++i) {
-        digit = grid[i] - 49;
-        if (digit >= 0) {
-            candidates[i] = 1 << digit;
-        } else {
-            candidates[i] = 0x01ff ^ (rows[row_index[i]] | columns[column_index[i]] | boxes[box_index[i]]);         
+// Trail mode:
+// back track to the state of the top entry of the trail and remove it.
+//
+inline void restore_from_trail(Trail &trail) {
+    TrailEntry *e = trail.top();
+    unlocked           = e->unlocked;
+    updated            = e->updated;
+    set23_found[0]     = e->set23_found[0];
+    set23_found[1]     = e->set23_found[1];
+    set23_found[2]     = e->set23_found[2];
+    triads_unlocked[0] = e->triads_unlocked[0];
+    triads_unlocked[1] = e->triads_unlocked[1];
+    stackpointer       = e->stackpointer;
+    candidates[80]     = e->candidate80;
+    const __m256i *c = (const __m256i *)(e+1);
+    for (unsigned char g = 0; g < 5; g++) {
+        if ( e->groups & (1<<g) ) {
+            _mm256_store_si256((__m256i*) &candidates[g<<4], _mm256_loadu_si256(c++));
         }
     }
+    for (unsigned char k = 0; k < e->patch_cnt; k++) {
+        candidates[e->patch_cells[k]] &= ~e->patch_mask;
+    }
+    trail.pop();
 }
 
 // Normally digits are entered by a 'goto enter;'.
@@ -741,7 +1184,7 @@ inline void initialize(signed char grid[81]) {
 // Only make_guess uses this member function.
 protected:
 template<bool verbose=false>
-inline __attribute__((always_inline)) void enter_digit( unsigned short digit, unsigned char i) {
+inline __attribute__((always_inline)) void enter_digit( unsigned short digit, unsigned char i, int debug) {
     // lock this cell and and remove this digit from the candidates in this row, column and box
 
     bit128_t to_update = {0};
@@ -782,8 +1225,8 @@ inline __attribute__((always_inline)) void enter_digit( unsigned short digit, un
 }
 
 public:
-template<bool verbose>
-inline GridState* make_guess(TriadInfo &triad_info, bit128_t bivalues) {
+template<bool verbose, bool opt_triad_res>
+inline GridState* make_guess(TriadInfo &triad_info, bit128_t bivalues, int debug, Trail *trail) {
     // Make a guess for a triad with 4 candidate values that has 2 candidates that are not
     // constrained to the triad (not in 'tmust') and has at least 2 or more unresolved cells.
     // If we cannot obtain such a triad, fall back to make_guess().
@@ -804,13 +1247,13 @@ inline GridState* make_guess(TriadInfo &triad_info, bit128_t bivalues) {
             int ti = tzcnt_and_mask(totest);
             int can_ti = ti-ti/10;   // 'canonical' triad index
             if ( __popcnt16 (wo_musts[ti]) == 2 ) {
-#ifndef OPT_TRIAD_RES
-                // OPT_TRIAD_RES did not prepare triad_info.triads_selection[i] above,
-                // so weed check whether the triad is 'interesting'
-                if ( __popcnt16(i==0?triad_info.row_triads[ti]:triad_info.col_triads[ti]) != 4 ) {
-                    continue;
+                if constexpr ( !opt_triad_res ) {
+                    // without triad resolution triad_info.triads_selection[i] was not prepared,
+                    // so weed check whether the triad is 'interesting'
+                    if ( __popcnt16(i==0?triad_info.row_triads[ti]:triad_info.col_triads[ti]) != 4 ) {
+                        continue;
+                    }
                 }
-#endif
                 // get and check the unlocked indexbits for the triad
                 unsigned int b;
                 if ( type == 0 ) {
@@ -830,37 +1273,59 @@ inline GridState* make_guess(TriadInfo &triad_info, bit128_t bivalues) {
         }
     }
     // if no suitable triad found, find a suitable bi-value.
-    return make_guess<verbose>(bivalues);
+    return make_guess<verbose>(bivalues, debug, trail);
 found:
     // update the current and the new grid_state with their respective candidate to delete
     unsigned short select_cand = 0x8000 >> __lzcnt16(*wo_musts);
     unsigned short other_cand  = *wo_musts & ~select_cand;
     
-    // Create a copy of the state of the grid to make back tracking possible
-    GridState* new_grid_state = this+1;
-    if ( stackpointer >= GRIDSTATE_MAX-1 ) {
-        fprintf(stderr, "Error: no GridState struct availabe\n");
-        exit(0);
+    short level = stackpointer;
+    GridState* new_grid_state;
+    unsigned char off = tpos;
+    if ( trail ) {
+        // Save the state with the other candidate removed to the trail
+        bit128_t triad_cells {};
+        triad_cells.set_indexbits(type == 0 ? 0x7 : 0x40201, off, type == 0 ? 3 : 19);
+        TrailEntry *e = save_to_trail(*trail, triad_cells);
+        e->updated.u128 |= triad_cells.u128;
+        e->patch_mask = other_cand;
+        e->patch_cnt  = 3;
+        for ( unsigned char k=0; k<3; k++) {
+            e->patch_cells[k] = off + k*inc;
+        }
+        new_grid_state = this;
+    } else {
+        // Create a copy of the state of the grid to make back tracking possible
+        new_grid_state = this+1;
+        if ( stackpointer >= GRIDSTATE_MAX-1 ) {
+            fprintf(stderr, "Error: no GridState struct availabe\n");
+            exit(0);
+        }
+        memcpy(new_grid_state, this, sizeof(GridState));
     }
-    memcpy(new_grid_state, this, sizeof(GridState));
     new_grid_state->stackpointer++;
 
-    unsigned char off = tpos;
     for ( unsigned char k=0; k<3; k++, tpos += inc) {
          new_grid_state->candidates[tpos] &= ~select_cand;
-         candidates[tpos] &= ~other_cand;
+         if ( !trail ) {
+             candidates[tpos] &= ~other_cand;
+         }
     }
     // Update candidates
     if (type == 0 ) {
-        updated.set_indexbits(0x7,off,3);
+        if ( !trail ) {
+            updated.set_indexbits(0x7,off,3);
+        }
         new_grid_state->updated.set_indexbits(7,off,3);
     } else {
-        updated.set_indexbits(0x40201,off,19);
+        if ( !trail ) {
+            updated.set_indexbits(0x40201,off,19);
+        }
         new_grid_state->updated.set_indexbits(0x40201,off,19);
     }
     
     if ( verbose && debug ) {
-        printf("guess at level >%d< - new level >%d<\n", stackpointer, new_grid_state->stackpointer);
+        printf("guess at level >%d< - new level >%d<\n", level, new_grid_state->stackpointer);
         printf("guess \\{%d} for %s triad at %s\n",
                1+_tzcnt_u32(select_cand), type==0?"row":"col", cl2txt[off]);
     }
@@ -868,15 +1333,14 @@ found:
         printf("guess saved state: \\{%d} for %s triad at %s\n",
                1+_tzcnt_u32(other_cand), type==0?"row":"col", cl2txt[off]);
     }
-    guesses++;
 
     return new_grid_state;
 }
 
 template<bool verbose>
-GridState* make_guess(bit128_t bivalues) {
+GridState* make_guess(bit128_t bivalues, int debug, Trail *trail, unsigned short guess_digit = 0) {
     // Find a cell with the least candidates. The first cell with 2 candidates will suffice.
-    // Pick the candidate with the highest value as the guess.
+    // Pick the candidate with the highest value as the guess, unless guess_digit is given.
     // Save the current grid state (with the chosen candidate eliminated) for tracking back.
 
     // Find the cell with fewest possible candidates
@@ -915,43 +1379,58 @@ GridState* make_guess(bit128_t bivalues) {
     
     // Find the first candidate in this cell (lsb set)
     // Note: using tzcnt would be equally valid; this pick is historical
-    unsigned short digit = 0x8000 >> __lzcnt16(candidates[guess_index]);
+    unsigned short digit = guess_digit ? guess_digit : 0x8000 >> __lzcnt16(candidates[guess_index]);
     
-    // Create a copy of the state of the grid to make back tracking possible
-    GridState* new_grid_state = this+1;
-    if ( stackpointer >= GRIDSTATE_MAX-1 ) {
-        fprintf(stderr, "Error: no GridState object availabe\n");
-        exit(0);
+    short level = stackpointer;
+    GridState* new_grid_state;
+    if ( trail ) {
+        // Save the state with the guessed candidate removed to the trail
+        TrailEntry *e = save_to_trail(*trail, bit128_t {});
+        e->updated.set_indexbit(guess_index);
+        e->patch_mask     = digit;
+        e->patch_cells[0] = guess_index;
+        e->patch_cnt      = 1;
+        new_grid_state = this;
+    } else {
+        // Create a copy of the state of the grid to make back tracking possible
+        new_grid_state = this+1;
+        if ( stackpointer >= GRIDSTATE_MAX-1 ) {
+            fprintf(stderr, "Error: no GridState object availabe\n");
+            exit(0);
+        }
+        memcpy(new_grid_state, this, sizeof(GridState));
+
+        // Remove the guessed candidate from the old grid
+        // when we get back here to the old grid, we know the guess was wrong
+        candidates[guess_index] &= ~digit;
+
+        updated.set_indexbit(guess_index);
     }
-    memcpy(new_grid_state, this, sizeof(GridState));
     new_grid_state->stackpointer++;
-    
-    // Remove the guessed candidate from the old grid
-    // when we get back here to the old grid, we know the guess was wrong
-    candidates[guess_index] &= ~digit;
-
-    updated.set_indexbit(guess_index);
 
     if ( verbose && (debug > 1) ) {
         char gridout[82];
         for (unsigned char j = 0; j < 81; ++j) {
-            if ( (candidates[j] & (candidates[j]-1)) ) {
+            unsigned short c = candidates[j];
+            if ( trail && j == guess_index ) {
+                c &= ~digit;
+            }
+            if ( (c & (c-1)) ) {
                 gridout[j] = '0';
             } else {
-                gridout[j] = 49+_tzcnt_u32(candidates[j]);
+                gridout[j] = 49+_tzcnt_u32(c);
             }
         }
         printf("guess at %s\nsaved grid_state level >%d<: %.81s\n",
-               cl2txt[guess_index], stackpointer, gridout);
+               cl2txt[guess_index], level, gridout);
     }
     
     // Update candidates
     if ( verbose && debug ) {
-        printf("guess at level >%d< - new level >%d<\nguess", stackpointer, new_grid_state->stackpointer);
+        printf("guess at level >%d< - new level >%d<\nguess", level, new_grid_state->stackpointer);
     }
     
-    new_grid_state->enter_digit<verbose>( digit, guess_index);
-    guesses++;
+    new_grid_state->enter_digit<verbose>( digit, guess_index, debug);
 
     if ( verbose && (debug > 1) ) {
         unsigned short *candidates = new_grid_state->candidates;
@@ -995,104 +1474,1113 @@ inline __m256i andnot_get_next_lsb(__m256i lsb, __m256i &vec) {
         return _mm256_and_si256(vec, _mm256_sub_epi16(_mm256_setzero_si256(), vec));
 }
 
-template <bool verbose>
-bool solve(signed char grid[81], GridState stack[], int line) {
+// Parallel search of a puzzle (-p)
+// With a BranchPool, a thread that makes a guess offers a branch of its search
+// (the state saved for back tracking) to idle threads.
+// The thread marks the level as given away and skips it when back tracking,
+// while the idle thread searches the branch.
+// All threads that search a puzzle share its SearchState, which collects the solutions.
+// Threads become idle when they run out of puzzles, so this helps with a single puzzle (-l)
+// as well as with the hard puzzles at the end of a batch.
+//
+class SearchState
+{
+public:
+    signed char *grid;                // the puzzle, receives the (first) solution
+    int line;
+    std::atomic<int> refs;            // the threads and branches working on the puzzle
+    std::atomic<int> solutions;       // the solutions found, counting stops at limit
+    std::atomic<bool> stop;           // the result is known, stop searching
+    int limit;
+    bool report;                      // report the count of the solutions (opts.solution_limit)
+
+    SearchState(signed char *grid_, int line_, int solutions_, int limit_, bool report_)
+        : grid(grid_), line(line_), refs(1), solutions(solutions_), stop(solutions_ >= limit_),
+          limit(limit_), report(report_) {}
+};
 
-    GridState *grid_state = &stack[0];
-    unsigned long long *unlocked = grid_state->unlocked.u64;
-    unsigned short* candidates;
+class __attribute__ ((aligned(64))) Branch
+{
+public:
+    GridState state;
+    SearchState *search;
+};
 
-    // the low byte is the real count, while
-    // the high byte is increased/decreased with each guess/back track
-    // init count of resolved cells to the size of the initial set
-    unsigned short current_entered_count = 81 - _popcnt64(unlocked[0]) - _popcnt32(unlocked[1]);
+class BranchPool
+{
+public:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<Branch> branches;
+    std::atomic<int> idle {0};        // threads waiting for a branch
+    int busy;                         // threads not waiting for a branch
+
+    BranchPool(int nthreads) : busy(nthreads) {}
+
+    // offer a branch of search, the state is copied.
+    void offer(const GridState &state, SearchState *search) {
+        search->refs++;
+        std::lock_guard<std::mutex> lock(mtx);
+        branches.emplace_back();
+        memcpy(&branches.back().state, &state, sizeof(GridState));
+        branches.back().state.stackpointer = 0;
+        branches.back().search = search;
+        cv.notify_one();
+    }
 
-#ifdef OPT_TRIAD_RES
-    unsigned short last_entered_count_col_triads = 0;
-#endif
+    // wait for a branch, returns false when all threads are done.
+    bool take(Branch &branch) {
+        std::unique_lock<std::mutex> lock(mtx);
+        busy--;
+        idle++;
+        if ( busy == 0 && branches.empty() ) {
+            cv.notify_all();
+        }
+        cv.wait(lock, [&] { return !branches.empty() || busy == 0; });
+        idle--;
+        if ( branches.empty() ) {
+            return false;
+        }
+        busy++;
+        memcpy(&branch, &branches.back(), sizeof(Branch));
+        branches.pop_back();
+        return true;
+    }
+};
 
-    int unique_check_mode = 0;
-    bool nonunique_reported = false;
+// the limit of the solutions of a puzzle to count
+inline int solution_limit(const schoku_opts &opts) {
+    return opts.unique_check ? (opts.solution_limit > 2 ? opts.solution_limit : 2) : 1;
+}
 
-   unsigned long long my_digits_entered_and_retracted = 0;
-   unsigned long long my_naked_sets_searched = 0;
-   unsigned char no_guess_incr = 1;
+// report the number of solutions of a puzzle, counted up to limit (-u#).
+// This is the one message of each puzzle with -u#, in place of "No solution found!" and
+// "solution to puzzle is not unique".  A count of limit means limit or more solutions.
+inline void report_solutions(int line, int solutions, int limit, Stats &stats) {
+    if ( solutions >= limit ) {
+        stats.limit_count++;
+    }
+    printf("Line %d: %d of at most %d solutions counted\n", line, solutions, limit);
+}
 
-    unsigned int my_past_naked_count = 0;
- 
-    if ( verbose && debug ) {
-        printf("Line %d: %.81s\n", line, grid);
+// a puzzle whose clues conflict (see GridState::initialize), it is not solved
+inline void conflicting_clues(int line, const schoku_opts &opts, Stats &stats) {
+    stats.unsolved_count++;
+    if ( opts.solution_limit ) {
+        report_solutions(line, 0, solution_limit(opts), stats);
+    } else {
+        printf("Line %d: No solution found!\n", line);
     }
+}
 
-    // The 'API' for code that uses the 'goto enter:' method of entering digits
-    unsigned short e_digit = 0;
-    unsigned char e_i = 0;
+// a thread or branch is done with a puzzle.
+// Report a puzzle without a solution (and the count of the solutions) once the last one is done.
+//
+inline void release_search(SearchState *search, Stats &stats) {
+    if ( --search->refs == 0 ) {
+        if ( search->solutions == 0 ) {
+            if ( !search->report ) {
+                printf("Line %d: No solution found!\n", search->line);
+            }
+            stats.unsolved_count++;
+        }
+        if ( search->report ) {
+            int n = search->solutions;
+            report_solutions(search->line, n < search->limit ? n : search->limit, search->limit, stats);
+        }
+        delete search;
+    }
+}
 
-    bool check_back = thorough_check;
-    goto start;
+// AVX-512 kernels
+// With AVX-512BW/VL the 81 candidates fit into three __m512i and the comparisons
+// yield bit masks that line up with the bit vectors for the cells (unlocked etc.),
+// which makes the movemask/compress steps of the AVX2 code unnecessary.
+// The third __m512i extends beyond the candidates into the GridState members that
+// follow them; these lanes are masked off.
+//
+// These kernels make the exact same choices as the AVX2 code they replace in solve.
+// Entering a digit stays with the AVX2 loop, which exits early on a back track and
+// measured faster than a masked 512-bit version.
+// They are not always_inline, as they can only be inlined into a function with the
+// AVX-512 target, i.e. solve_avx512.
+// Only with the AVX2 backend (see simd.h), otherwise they are declared for the
+// (discarded) AVX-512 branches of solve, but there is no AVX-512 instantiation.
+//
+#ifdef SCHOKU_SIMD_AVX2
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl")))
+#else
+#define TARGET_AVX512
+#endif
 
-back:
+bool avx512_support = false;
 
-    // Each algorithm (naked single, hidden single, naked set)
-    // has its own non-solvability detecting trap door to detect the grid is bad.
-    // This section acts upon that detection and discards the current grid_state.
-    //    
-    if (grid_state->stackpointer == 0) {
-        if ( unique_check_mode ) {
-            if ( verbose && debug ) {
-                // no additional solution exists
-                printf("No secondary solution found during back track\n");
+typedef
+enum Detected {
+   Nothing     = 0,
+   ZeroCell    = 1,   // a cell without candidates (back track)
+   NakedSingle = 2,
+} Detected;
+
+#ifdef SCHOKU_SIMD_AVX2
+// check cells 0-79 in groups of 16 cells, skipping groups without unlocked cells:
+// the first group with a cell without candidates (if check_back) or a naked single decides,
+// a cell without candidates takes precedence within the group.
+inline TARGET_AVX512 Detected find_naked_single_avx512(const unsigned short *candidates, bit128_t unlocked,
+                                         bool check_back, unsigned char &pos) {
+    const __m512i ones = _mm512_set1_epi16(1);
+    bit128_t zeros, singles;
+    for (unsigned char j = 0; j < 96; j += 32) {
+        __m512i c = _mm512_load_si512((__m512i*) &candidates[j]);
+        zeros.u32[j>>5]   = _mm512_testn_epi16_mask(c, c);
+        singles.u32[j>>5] = _mm512_testn_epi16_mask(c, _mm512_sub_epi16(c, ones));
+    }
+    for (unsigned char g = 0; g < 5; g++) {
+        unsigned short m = unlocked.u16[g];
+        if ( m ) {
+            if ( __builtin_expect (check_back && zeros.u16[g], 0) ) {
+                pos = (g<<4) + _tzcnt_u32(zeros.u16[g]);
+                return ZeroCell;
+            }
+            if ( singles.u16[g] & m ) {
+                pos = (g<<4) + _tzcnt_u32(singles.u16[g] & m);
+                return NakedSingle;
             }
-        } else {
-            // This only happens when the puzzle is not valid
-            // Bypass the verbose check...
-            printf("Line %d: No solution found!\n", line);
-            unsolved_count++;
-        }
-        // cleanup and return
-        if ( verbose && reportstats ) {
-            past_naked_count += my_past_naked_count;
-            naked_sets_searched += my_naked_sets_searched;
-            digits_entered_and_retracted += my_digits_entered_and_retracted;
         }
-        return true;
     }
+    return Nothing;
+}
+
+// the cells with exactly two candidates
+inline TARGET_AVX512 bit128_t get_bivalues_avx512(const unsigned short *candidates) {
+    const __m512i ones = _mm512_set1_epi16(1);
+    bit128_t bivalues {};
+    for (unsigned char j = 0; j < 96; j += 32) {
+        __m512i c = _mm512_load_si512((__m512i*) &candidates[j]);
+        // remove the lsb, exactly one bit must remain
+        c = _mm512_and_si512(c, _mm512_sub_epi16(c, ones));
+        bivalues.u32[j>>5] = _mm512_mask_testn_epi16_mask(_mm512_test_epi16_mask(c, c), c, _mm512_sub_epi16(c, ones));
+    }
+    bivalues.u32[2] &= 0x1ffff;
+    return bivalues;
+}
 
-    current_entered_count  = ((grid_state-1)->stackpointer)<<8;        // back to previous stack.
-    current_entered_count += _popcnt64((grid_state-1)->unlocked.u64[0]) + _popcnt32((grid_state-1)->unlocked.u64[1]);
+// the non-zero elements of a, selected by b, one bit per element
+// (compare to and_compress_masks<true>, which gives two bits per element)
+inline TARGET_AVX512 unsigned int select_nonzero_avx512(__m256i a, unsigned short b) {
+    return _mm256_mask_test_epi16_mask(b, a, a);
+}
+#else
+Detected find_naked_single_avx512(const unsigned short *candidates, bit128_t unlocked, bool check_back, unsigned char &pos);
+bit128_t get_bivalues_avx512(const unsigned short *candidates);
+unsigned int select_nonzero_avx512(__m256i a, unsigned short b);
+#endif
 
-    // collect some guessing stats
-    if ( verbose && reportstats ) {
-        my_digits_entered_and_retracted += 
-            (_popcnt64((grid_state-1)->unlocked.u64[0] & ~grid_state->unlocked.u64[0]))
-          + (_popcnt32((grid_state-1)->unlocked.u64[1] & ~grid_state->unlocked.u64[1]));
+// digit planes
+// The candidates by digit: bit i of planes[d] is set if digit d+1 is a candidate of
+// the unlocked cell i.  The planes are derived from the cell-major candidates on demand
+// (for the fish search), a compare and a compress per 16 (AVX-512: 32) cells and digit.
+//
+template<bool bmi2>
+inline void get_digit_planes(const unsigned short *candidates, const bit128_t &unlocked, bit128_t planes[9]) {
+    const __m256i c0 = _mm256_load_si256((__m256i*) &candidates[0]);
+    const __m256i c1 = _mm256_load_si256((__m256i*) &candidates[16]);
+    const __m256i c2 = _mm256_load_si256((__m256i*) &candidates[32]);
+    const __m256i c3 = _mm256_load_si256((__m256i*) &candidates[48]);
+    const __m256i c4 = _mm256_load_si256((__m256i*) &candidates[64]);
+    for (unsigned char d = 0; d < 9; d++) {
+        const __m256i bit = _mm256_set1_epi16(1<<d);
+        bit128_t p;
+        p.u32[0] = compress_epi16_boolean<false>(_mm256_cmpeq_epi16(_mm256_and_si256(c0, bit), bit),
+                                                 _mm256_cmpeq_epi16(_mm256_and_si256(c1, bit), bit));
+        p.u32[1] = compress_epi16_boolean<false>(_mm256_cmpeq_epi16(_mm256_and_si256(c2, bit), bit),
+                                                 _mm256_cmpeq_epi16(_mm256_and_si256(c3, bit), bit));
+        p.u32[2] = compress_epi16_boolean<false, bmi2>(_mm256_cmpeq_epi16(_mm256_and_si256(c4, bit), bit))
+                 | ((candidates[80] >> d & 1) << 16);
+        p.u32[3] = 0;
+        planes[d].u128 = p.u128 & unlocked.u128;
     }
+}
 
-    // Go back to the state when the last guess was made
-    // This state had the guess removed as candidate from it's cell
+#ifdef SCHOKU_SIMD_AVX2
+inline TARGET_AVX512 void get_digit_planes_avx512(const unsigned short *candidates, const bit128_t &unlocked, bit128_t planes[9]) {
+    const __m512i c0 = _mm512_load_si512((__m512i*) &candidates[0]);
+    const __m512i c1 = _mm512_load_si512((__m512i*) &candidates[32]);
+    const __m512i c2 = _mm512_load_si512((__m512i*) &candidates[64]);
+    for (unsigned char d = 0; d < 9; d++) {
+        const __m512i bit = _mm512_set1_epi16(1<<d);
+        bit128_t p;
+        p.u32[0] = _mm512_test_epi16_mask(c0, bit);
+        p.u32[1] = _mm512_test_epi16_mask(c1, bit);
+        p.u32[2] = _mm512_test_epi16_mask(c2, bit);
+        p.u32[3] = 0;
+        planes[d].u128 = p.u128 & unlocked.u128;
+    }
+}
+#else
+void get_digit_planes_avx512(const unsigned short *candidates, const bit128_t &unlocked, bit128_t planes[9]);
+#endif
 
-    if ( verbose && debug ) {
-        printf("back track to level >%d<\n", grid_state->stackpointer-1);
+// fish (X-Wing and Swordfish)
+// If the candidates of a digit in k rows (k = 2 for an X-Wing, 3 for a Swordfish) are
+// confined to k columns, the digit is in these columns in one of these rows,
+// and it is removed from the other cells of the columns.  Likewise with columns and rows swapped.
+// With the digit planes, the rows of a digit are 9-bit masks of its columns,
+// which are transposed for the columns.
+// Returns the number of candidates removed, the cells are added to updated.
+//
+template <bool verbose, bool avx512, bool bmi2>
+inline unsigned int eliminate_fish(unsigned short *candidates, const bit128_t &unlocked, bit128_t &updated,
+                                   int debug, Stats &stats) {
+    bit128_t planes[9];
+    if constexpr (avx512) {
+        get_digit_planes_avx512(candidates, unlocked, planes);
+    } else {
+        get_digit_planes<bmi2>(candidates, unlocked, planes);
     }
-    trackbacks++;
-    grid_state--;
 
-start:
+    unsigned int removed = 0;
+    for (unsigned char d = 0; d < 9; d++) {
+        if ( planes[d].u128 == 0 ) {
+            continue;
+        }
+        // lines[Row][r]: the columns of the candidates in row r, lines[Col][c]: the rows in column c
+        unsigned short lines[2][9] = {{0}};
+        for (unsigned char r = 0; r < 9; r++) {
+            unsigned short m = (unsigned short)(planes[d].u128 >> (9*r)) & 0x1ff;
+            lines[Row][r] = m;
+            while ( m ) {
+                lines[Col][_tzcnt_u32(m)] |= 1<<r;
+                m = _blsr_u32(m);
+            }
+        }
+        for (int kind = Row; kind <= Col; kind++) {
+            unsigned short *base  = lines[kind];
+            unsigned short *cover = lines[1-kind];
+
+            // remove the candidates of the cover lines u outside the base lines b
+            auto remove = [&](unsigned short b, unsigned short u) {
+                unsigned int cnt = 0;
+                for (unsigned short um = u; um; um = _blsr_u32(um)) {
+                    unsigned char x = _tzcnt_u32(um);
+                    for (unsigned short hits = cover[x] & ~b; hits; hits = _blsr_u32(hits)) {
+                        unsigned char y = _tzcnt_u32(hits);
+                        unsigned char i = kind == Row ? 9*y + x : 9*x + y;
+                        candidates[i] &= ~(1<<d);
+                        updated.set_indexbit(i);
+                        base[y] &= ~(1<<x);
+                        cover[x] &= ~(1<<y);
+                        cnt++;
+                    }
+                }
+                if ( cnt ) {
+                    if ( verbose ) {
+                        stats.fish_found++;
+                        stats.fish_removed += cnt;
+                        if ( debug ) {
+                            printf("%s %d (%s", __popcnt16(b) == 2 ? "x-wing" : "swordfish", d+1, kind == Row ? "rows" : "cols");
+                            for (unsigned short bm = b; bm; bm = _blsr_u32(bm)) {
+                                printf(" %d", _tzcnt_u32(bm));
+                            }
+                            printf("): %d candidates removed\n", cnt);
+                        }
+                    }
+                    removed += cnt;
+                }
+            };
+
+            // the lines with 2 or 3 candidates
+            unsigned char l[9];
+            unsigned char n = 0;
+            for (unsigned char k = 0; k < 9; k++) {
+                unsigned short cnt = __popcnt16(base[k]);
+                if ( cnt >= 2 && cnt <= 3 ) {
+                    l[n++] = k;
+                }
+            }
+            // (a line can lose candidates to an earlier fish, lines without any are skipped)
+            for (unsigned char a = 0; a < n; a++) {
+                for (unsigned char b = a+1; b < n && base[l[a]]; b++) {
+                    if ( base[l[b]] == 0 ) {
+                        continue;
+                    }
+                    unsigned short u2 = base[l[a]] | base[l[b]];
+                    if ( __popcnt16(u2) == 2 ) {
+                        remove((1<<l[a]) | (1<<l[b]), u2);
+                    }
+                    if ( __popcnt16(u2) > 3 ) {
+                        continue;
+                    }
+                    for (unsigned char c = b+1; c < n; c++) {
+                        unsigned short u3 = u2 | base[l[c]];
+                        if ( __popcnt16(u3) == 3 && base[l[c]] ) {
+                            remove((1<<l[a]) | (1<<l[b]) | (1<<l[c]), u3);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return removed;
+}
 
-    e_digit = 0;
+// verify_solution
+// quickly assert that the solution in candidates (one bit per cell) is valid:
+// no cell has more than one digit set, all rows, columns and boxes have all digits set.
+// candidates is read up to element 87.
+//
+inline bool verify_solution(const unsigned short *candidates) {
+    const __m256i mask9 { -1LL, -1LL, 0xffffLL, 0 };
+    const __m256i ones = _mm256_and_si256(_mm256_set1_epi16(1), mask9);
+    __m256i rowx;
+    __m256i colx;
+    __m256i boxx;
+    boxx = colx = rowx = _mm256_and_si256(_mm256_set1_epi16(0x1ff),mask9);
+    __m256i uniq = _mm256_setzero_si256();
+
+    for (unsigned char i = 0; i < 9; i++) {
+        // load element i of 9 rows
+        __m256i row = _mm256_set_epi16(0, 0, 0, 0, 0, 0, 0, candidates[i+72],
+                      candidates[i+63], candidates[i+54], candidates[i+45], candidates[i+36], candidates[i+27], candidates[i+18], candidates[i+9], candidates[i]);
+        rowx = _mm256_xor_si256(rowx,row);
+
+        // load element i of 9 columns
+        __m256i col = _mm256_and_si256(*(__m256i_u*) &candidates[i*9], mask9);
+        colx = _mm256_xor_si256(colx,col);
+
+        uniq = _mm256_or_si256(_mm256_and_si256(col, _mm256_sub_epi16(col, ones)),uniq);
+
+        // load element i of 9 boxes
+        int bi = i%3+i/3*9; // starting in box 0
+        __m256i box = _mm256_set_epi16(0, 0, 0, 0, 0, 0, 0, candidates[bi+60],
+                      candidates[bi+57], candidates[bi+54], candidates[bi+33], candidates[bi+30], candidates[bi+27], candidates[bi+6], candidates[bi+3], candidates[bi]);
+        boxx = _mm256_xor_si256(boxx,box);
+    }
 
-    // at start, set everything that depends on grid_state:
-    check_back = grid_state->stackpointer || thorough_check || unique_check_mode;
+    __m256i res = _mm256_or_si256(rowx,colx);
+    res = _mm256_or_si256(res, boxx);
+    res = _mm256_or_si256(res, uniq);
+    return ~_mm256_movemask_epi8(_mm256_cmpeq_epi16(res,_mm256_setzero_si256())) == 0;
+}
 
-    unlocked   = grid_state->unlocked.u64;
-    candidates = grid_state->candidates;
+// The digit-major engine (-g1, and the search of the hybrid engine -g2)
+// The state is a plane per digit: the cells where the digit can (still) go, including the
+// cell where it is entered, in 3 words of 27 bits, one per band; and the unsolved cells.
+// Entering a digit clears it from the planes of the other digits in its cell,
+// and clears the peers of the cell (its row, column and box) in its own plane.
+// The naked singles and the cells without candidates are found by counting the planes
+// bit-sliced, a band at a time; the hidden singles by masking the planes with the units.
+// Then the locked candidates are removed, band- and stack-wise.
+// Guesses are made on a cell with the fewest candidates, the state is copied for a guess.
+//
+// the first row, column and box of a band word
+#define DIGIT_ROW    0x1ffu
+#define DIGIT_COLUMN (1u | 1u << 9 | 1u << 18)
+#define DIGIT_BOX    (0x7u | 0x7u << 9 | 0x7u << 18)
 
-    const __m256i ones = _mm256_set1_epi16(1);
+inline bool single_bit(unsigned int m) {
+    return m && (m & (m-1)) == 0;
+}
 
-// algorithm 0:
-// Enter a digit into the solution by setting it as the value of cell and by
-// removing the cell from the set of unlocked cells.  Update all affected cells
-// by removing any now impossible candidates.
+struct DigitTables {
+    unsigned int peers[81][3];          // the row, column and box of a cell, without the cell
+    unsigned char groups_of[512];       // the groups of 3 bits (of 9) with a bit set
+    unsigned char columns_of[512];      // the columns of a 3x3 pattern with a bit set
+
+    DigitTables() {
+        memset(peers, 0, sizeof(peers));
+        for (unsigned char i = 0; i < 81; i++) {
+            for (unsigned char j = 0; j < 81; j++) {
+                if ( j != i && (row_index[j] == row_index[i] || column_index[j] == column_index[i] || box_index[j] == box_index[i]) ) {
+                    peers[i][j/27] |= 1 << (j%27);
+                }
+            }
+        }
+        for (unsigned int m = 0; m < 512; m++) {
+            groups_of[m]  = (m & 0x7 ? 1 : 0) | (m & 0x38 ? 2 : 0) | (m & 0x1c0 ? 4 : 0);
+            columns_of[m] = (m & 0x49 ? 1 : 0) | (m & 0x92 ? 2 : 0) | (m & 0x124 ? 4 : 0);
+        }
+    }
+};
+
+static const DigitTables digit_tables;
+
+struct DigitState {
+    unsigned int planes[9][3];
+    unsigned int unsolved[3];
+    unsigned int changed;               // the digits with planes changed since the last hidden singles search
+
+    // enter digit d into cell i, false if d is not a candidate of i
+    inline bool enter(unsigned char d, unsigned char i) {
+        unsigned char b = i/27;
+        unsigned int bit = 1 << (i%27);
+        if ( !(planes[d][b] & bit) ) {
+            return false;
+        }
+        for (unsigned char e = 0; e < 9; e++) {
+            changed |= (planes[e][b] & bit) ? 1 << e : 0;
+            planes[e][b] &= ~bit;
+        }
+        planes[d][b] |= bit;
+        for (unsigned char k = 0; k < 3; k++) {
+            planes[d][k] &= ~digit_tables.peers[i][k];
+        }
+        unsolved[b] &= ~bit;
+        return true;
+    }
+
+    // the state of the puzzle in grid, false if the givens contradict each other
+    inline bool initialize(const signed char grid[81]) {
+        for (unsigned char d = 0; d < 9; d++) {
+            planes[d][0] = planes[d][1] = planes[d][2] = 0x7ffffff;
+        }
+        unsolved[0] = unsolved[1] = unsolved[2] = 0x7ffffff;
+        changed = 0x1ff;
+        for (unsigned char i = 0; i < 81; i++) {
+            if ( grid[i] > '0' && grid[i] <= '9' && !enter(grid[i]-'1', i) ) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the state of a GridState of the cell-major engine
+    inline void initialize(GridState &state) {
+        const bit128_t all = { .u128 = ~(__uint128_t)0 };
+        bit128_t p[9];
+        // once per hand over, the portable compress will do
+        get_digit_planes<false>(state.candidates, all, p);
+        for (unsigned char d = 0; d < 9; d++) {
+            for (unsigned char b = 0; b < 3; b++) {
+                planes[d][b] = (unsigned int)(p[d].u128 >> (27*b)) & 0x7ffffff;
+            }
+        }
+        for (unsigned char b = 0; b < 3; b++) {
+            unsolved[b] = (unsigned int)(state.unlocked.u128 >> (27*b)) & 0x7ffffff;
+        }
+        changed = 0x1ff;
+    }
+
+    inline bool solved() {
+        return (unsolved[0] | unsolved[1] | unsolved[2]) == 0;
+    }
+
+    // enter the naked and hidden singles until there are none, false on a contradiction
+    inline bool propagate() {
+        bool progress;
+        do {
+            progress = false;
+            // naked singles
+            for (unsigned char b = 0; b < 3; b++) {
+                unsigned int one = 0;
+                unsigned int two = 0;
+                for (unsigned char d = 0; d < 9; d++) {
+                    two |= one & planes[d][b];
+                    one |= planes[d][b];
+                }
+                if ( unsolved[b] & ~one ) {
+                    return false;
+                }
+                for (unsigned int singles = unsolved[b] & ~two; singles; singles = _blsr_u32(singles)) {
+                    unsigned char c = _tzcnt_u32(singles);
+                    unsigned char d = 0;
+                    while ( d < 9 && !(planes[d][b] & (1 << c)) ) {
+                        d++;
+                    }
+                    if ( d == 9 || !enter(d, 27*b + c) ) {
+                        return false;
+                    }
+                    progress = true;
+                }
+            }
+            if ( progress ) {
+                continue;
+            }
+            // hidden singles
+            // A unit with a single candidate of a digit has it entered already, or it is a hidden single.
+            for (unsigned int digits = changed; digits; digits = _blsr_u32(digits)) {
+                unsigned char d = _tzcnt_u32(digits);
+                changed &= ~(1 << d);
+                unsigned int *p = planes[d];
+                for (unsigned char b = 0; b < 3; b++) {
+                    for (unsigned char k = 0; k < 3; k++) {
+                        unsigned int row = p[b] & DIGIT_ROW << 9*k;
+                        unsigned int box = p[b] & DIGIT_BOX << 3*k;
+                        if ( row == 0 || box == 0 ) {
+                            return false;
+                        }
+                        if ( single_bit(row) && (row & unsolved[b]) ) {
+                            if ( !enter(d, 27*b + _tzcnt_u32(row)) ) {
+                                return false;
+                            }
+                            progress = true;
+                        }
+                        box = p[b] & DIGIT_BOX << 3*k;
+                        if ( single_bit(box) && (box & unsolved[b]) ) {
+                            if ( !enter(d, 27*b + _tzcnt_u32(box)) ) {
+                                return false;
+                            }
+                            progress = true;
+                        }
+                    }
+                }
+                for (unsigned char c = 0; c < 9; c++) {
+                    unsigned int m0 = p[0] & DIGIT_COLUMN << c;
+                    unsigned int m1 = p[1] & DIGIT_COLUMN << c;
+                    unsigned int m2 = p[2] & DIGIT_COLUMN << c;
+                    unsigned int cnt = _popcnt32(m0 | m1 << 1 | m2 << 2);
+                    if ( cnt == 0 ) {
+                        return false;
+                    }
+                    if ( cnt == 1 ) {
+                        unsigned char b = m0 ? 0 : m1 ? 1 : 2;
+                        unsigned int m = m0 | m1 | m2;
+                        if ( m & unsolved[b] ) {
+                            if ( !enter(d, 27*b + _tzcnt_u32(m)) ) {
+                                return false;
+                            }
+                            progress = true;
+                        }
+                    }
+                }
+            }
+        } while ( progress );
+        return true;
+    }
+
+    // locked candidates: the candidates of a digit in a box that are confined to one row
+    // (column) are removed from the rest of the row (column), and the candidates in a row
+    // (column) that are confined to one box are removed from the rest of the box.
+    // Returns true if candidates were removed.
+    inline bool locked_candidates() {
+        bool removed = false;
+        for (unsigned char d = 0; d < 9; d++) {
+            unsigned int *p = planes[d];
+            const unsigned int before[3] = { p[0], p[1], p[2] };
+            for (unsigned char b = 0; b < 3; b++) {
+                for (unsigned char k = 0; k < 3; k++) {
+                    // the 3x3 pattern of the box
+                    unsigned int w = p[b];
+                    unsigned short box = (w >> 3*k & 0x7) | (w >> (6+3*k) & 0x38) | (w >> (12+3*k) & 0x1c0);
+                    unsigned char rows = digit_tables.groups_of[box];
+                    unsigned char cols = digit_tables.columns_of[box];
+                    if ( single_bit(rows) ) {
+                        // pointing
+                        unsigned char r = _tzcnt_u32(rows);
+                        p[b] &= ~(DIGIT_ROW << 9*r & ~(DIGIT_BOX << 3*k));
+                    }
+                    if ( single_bit(cols) ) {
+                        // pointing across the bands
+                        unsigned char c = 3*k + _tzcnt_u32(cols);
+                        for (unsigned char o = 0; o < 3; o++) {
+                            p[o] &= (o == b) ? ~0u : ~(DIGIT_COLUMN << c);
+                        }
+                    }
+                }
+                for (unsigned char r = 0; r < 3; r++) {
+                    unsigned char boxes = digit_tables.groups_of[p[b] >> 9*r & 0x1ff];
+                    if ( single_bit(boxes) ) {
+                        // claiming
+                        unsigned char k = _tzcnt_u32(boxes);
+                        p[b] &= ~(DIGIT_BOX << 3*k & ~(DIGIT_ROW << 9*r));
+                    }
+                }
+            }
+            for (unsigned char c = 0; c < 9; c++) {
+                unsigned char bands = ((p[0] >> c) & DIGIT_COLUMN ? 1 : 0) | ((p[1] >> c) & DIGIT_COLUMN ? 2 : 0) | ((p[2] >> c) & DIGIT_COLUMN ? 4 : 0);
+                if ( single_bit(bands) ) {
+                    // claiming across the bands
+                    unsigned char b = _tzcnt_u32(bands);
+                    p[b] &= ~(DIGIT_BOX << 3*(c/3) & ~(DIGIT_COLUMN << c));
+                }
+            }
+            if ( (before[0] ^ p[0]) | (before[1] ^ p[1]) | (before[2] ^ p[2]) ) {
+                changed |= 1 << d;
+                removed = true;
+            }
+        }
+        return removed;
+    }
+
+    // the unsolved cell with the fewest candidates, preferably a bi-value cell
+    inline unsigned char guess_cell() {
+        unsigned char best = 0;
+        unsigned int best_cnt = 10;
+        for (unsigned char b = 0; b < 3; b++) {
+            unsigned int one = 0;
+            unsigned int two = 0;
+            unsigned int three = 0;
+            for (unsigned char d = 0; d < 9; d++) {
+                three |= two & planes[d][b];
+                two |= one & planes[d][b];
+                one |= planes[d][b];
+            }
+            unsigned int bivalues = unsolved[b] & ~three;
+            if ( bivalues ) {
+                return 27*b + _tzcnt_u32(bivalues);
+            }
+            for (unsigned int m = unsolved[b]; m && best_cnt > 3; m = _blsr_u32(m)) {
+                unsigned char c = _tzcnt_u32(m);
+                unsigned int cnt = 0;
+                for (unsigned char d = 0; d < 9; d++) {
+                    cnt += (planes[d][b] >> c) & 1;
+                }
+                if ( cnt < best_cnt ) {
+                    best_cnt = cnt;
+                    best = 27*b + c;
+                }
+            }
+        }
+        return best;
+    }
+
+    inline void to_grid(signed char grid[81]) {
+        for (unsigned char i = 0; i < 81; i++) {
+            unsigned char d = 0;
+            while ( d < 8 && !(planes[d][i/27] & (1 << (i%27))) ) {
+                d++;
+            }
+            grid[i] = '1' + d;
+        }
+    }
+
+    // one candidate bit per cell, as the GridState candidates (for verify_solution)
+    inline void to_candidates(unsigned short candidates[96]) {
+        memset(candidates, 0, 96*sizeof(unsigned short));
+        for (unsigned char d = 0; d < 9; d++) {
+            for (unsigned char i = 0; i < 81; i++) {
+                if ( planes[d][i/27] & (1 << (i%27)) ) {
+                    candidates[i] |= 1 << d;
+                }
+            }
+        }
+    }
+};
+
+// DigitSearch
+// the search of the solutions of a puzzle by the digit-major engine, in steps.
+// Each step enters the singles, then makes a guess, takes a solution or backtracks.
+// The counting of the solutions, uniqueness check, verification and the statistics are as in solve.
+// The searches of several puzzles can be advanced in turn (see solve_interleaved).
+//
+struct DigitSearch {
+    DigitState state;
+    DigitState stack[81];
+    signed char *grid;            // the puzzle, receives the (first) solution
+    int line;
+    int sp;
+    int solutions;
+    int limit;
+    unsigned char no_guess_incr;
+    bool ok;
+
+    // initial_ok is false if state is contradictory already (e.g. by the givens).
+    inline void start(const DigitState &state_, signed char grid_[81], int line_, const schoku_opts &opts, bool initial_ok) {
+        state = state_;
+        start(grid_, line_, opts);
+        ok = initial_ok;
+    }
+    // the puzzle in grid
+    inline void start(signed char grid_[81], int line_, const schoku_opts &opts) {
+        grid = grid_;
+        line = line_;
+        sp = 0;
+        solutions = 0;
+        limit = solution_limit(opts);
+        no_guess_incr = 1;
+        ok = state.initialize(grid);
+    }
+
+    // one step of the search, returns false once the search is done
+    template <bool verbose>
+    inline bool step(const schoku_opts &opts, Stats &stats) {
+        const int reportstats    = opts.reportstats;
+        const int debug          = opts.debug;
+
+        if ( ok && state.propagate() ) {
+            if ( !state.solved() ) {
+                if ( state.locked_candidates() ) {
+                    return true;
+                }
+                // guess the first candidate of a cell, the others are left to back track to
+                unsigned char i = state.guess_cell();
+                unsigned char b = i/27;
+                unsigned char d = 0;
+                while ( !(state.planes[d][b] & (1 << (i%27))) ) {
+                    d++;
+                }
+                if ( verbose && debug ) {
+                    printf("guess %d at %s (level %d)\n", d+1, cl2txt[i], sp);
+                }
+                stack[sp] = state;
+                stack[sp].planes[d][b] &= ~(1 << (i%27));
+                stack[sp].changed |= 1 << d;
+                sp++;
+                stats.guesses++;
+                no_guess_incr = 0;
+                ok = state.enter(d, i);
+                return true;
+            }
+
+            // solved it
+            solutions++;
+            if ( opts.unique_check && solutions == 2 ) {
+                if ( verbose && reportstats && !opts.solution_limit ) {
+                    printf("Line %d: solution to puzzle is not unique\n", line);
+                }
+                stats.non_unique_count++;
+            }
+            if ( opts.verify ) {
+                alignas(32) unsigned short candidates[96];
+                state.to_candidates(candidates);
+                if ( !verify_solution(candidates) ) {
+                    if ( solutions == 1 ) {
+                        if ( verbose ) {
+                            printf("Line %d: solution to puzzle failed verification\n", line);
+                        }
+                        stats.unsolved_count++;
+                        stats.not_verified_count++;
+                    } else if ( verbose ) {
+                        printf("unique check: not a valid solution\n");
+                    }
+                } else if ( verbose ) {
+                    if ( debug ) {
+                        printf("Solution found and verified\n");
+                    }
+                    if ( reportstats && solutions == 1 ) {
+                        stats.solved_count++;
+                        stats.verified_count++;
+                    }
+                }
+            } else if ( verbose && reportstats && solutions == 1 ) {
+                stats.solved_count++;
+            }
+            if ( solutions == 1 ) {
+                state.to_grid(grid);
+                if ( verbose && reportstats ) {
+                    stats.no_guess_cnt += no_guess_incr;
+                }
+            }
+            if ( solutions == limit ) {
+                return finish<verbose>(opts, stats);
+            }
+            if ( verbose && debug ) {
+                printf("%s", solutions == 1 ? "Back track to determine uniqueness\n" : "back track during unique check (OK)\n");
+            }
+        }
+        // back track
+        if ( sp == 0 ) {
+            return finish<verbose>(opts, stats);
+        }
+        if ( verbose && debug ) {
+            printf("back track to level >%d<\n", sp-1);
+        }
+        stats.trackbacks++;
+        state = stack[--sp];
+        ok = true;
+        return true;
+    }
+
+    template <bool verbose>
+    inline bool finish(const schoku_opts &opts, Stats &stats) {
+        if ( solutions == 0 ) {
+            if ( !opts.solution_limit ) {
+                printf("Line %d: No solution found!\n", line);
+            }
+            stats.unsolved_count++;
+        } else if ( verbose && opts.debug && solutions == 1 && opts.unique_check ) {
+            printf("No secondary solution found during back track\n");
+        }
+        if ( opts.solution_limit ) {
+            report_solutions(line, solutions, limit, stats);
+        }
+        return false;
+    }
+};
+
+// solve_digits
+// search the solutions of state with the digit-major engine.
+// initial_ok is false if state is contradictory already (e.g. by the givens).
+//
+template <bool verbose>
+void solve_digits(DigitState &state, signed char grid[81], int line, const schoku_opts &opts, Stats &stats, bool initial_ok = true) {
+    DigitSearch search;
+    search.start(state, grid, line, opts, initial_ok);
+    while ( search.step<verbose>(opts, stats) ) {
+    }
+}
+
+// solve a puzzle with the digit-major engine
+template <bool verbose>
+void solve_digits(signed char grid[81], int line, const schoku_opts &opts, Stats &stats) {
+    if ( verbose && opts.debug ) {
+        printf("Line %d: %.81s\n", line, grid);
+    }
+    DigitState state;
+    bool ok = state.initialize(grid);
+    solve_digits<verbose>(state, grid, line, opts, stats, ok);
+}
+
+// solve_interleaved
+// solve n puzzles with the digit-major engine, width (up to INTERLEAVE_MAX) at a time (-i):
+// the searches are advanced by a step in turn, so the independent work of different
+// puzzles overlaps instead of waiting on the dependency chain and the branches of one search.
+// A puzzle that is done is replaced by the next one.
+// grids[k] is the grid of puzzle k, solved in place, at line lines[k].
+// If latency is not 0, the time from the start to the end of the search of each puzzle is added to it.
+//
+#define INTERLEAVE_MAX 4
+
+template <bool verbose>
+void solve_interleaved(size_t n, signed char *grids[], const size_t lines[], int width, const schoku_opts &opts,
+                       Stats &stats, Latency *latency) {
+    DigitSearch searches[INTERLEAVE_MAX];
+    std::chrono::steady_clock::time_point start[INTERLEAVE_MAX];
+    bool live[INTERLEAVE_MAX];
+    size_t next = 0;
+    int nlive = 0;
+
+    width = width < INTERLEAVE_MAX ? width : INTERLEAVE_MAX;
+    auto start_next = [&](int s) {
+        live[s] = next < n;
+        if ( live[s] ) {
+            searches[s].start(grids[next], lines[next], opts);
+            if ( latency ) {
+                start[s] = std::chrono::steady_clock::now();
+            }
+            next++;
+        }
+        return live[s];
+    };
+    for (int s = 0; s < width; s++) {
+        nlive += start_next(s);
+    }
+    while ( nlive ) {
+        for (int s = 0; s < width; s++) {
+            if ( live[s] && !searches[s].step<verbose>(opts, stats) ) {
+                if ( latency ) {
+                    latency->record(searches[s].line, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start[s]).count());
+                }
+                nlive -= !start_next(s);
+            }
+        }
+    }
+}
+
+// probe_guesses
+// failed-literal probing before a guess (-k): for both candidates of each of the first
+// 'cells' bi-value cells, the candidate is entered on a scratch copy (a DigitState) and the
+// singles are propagated.  A candidate that leads to a contradiction is removed at once,
+// otherwise the candidate that solves the most cells is returned as the guess.
+// Returns the number of candidates removed, else guess_index and guess_digit are set
+// (guess_digit is 0 if there is no bi-value cell).
+//
+template <bool verbose>
+inline unsigned int probe_guesses(GridState &grid_state, bit128_t bivalues, int cells, int debug, Stats &stats,
+                                  unsigned char &guess_index, unsigned short &guess_digit) {
+    guess_digit = 0;
+    if ( bivalues.u128 == 0 ) {
+        return 0;
+    }
+    DigitState state;
+    state.initialize(grid_state);
+    unsigned int unsolved = _popcnt32(state.unsolved[0]) + _popcnt32(state.unsolved[1]) + _popcnt32(state.unsolved[2]);
+
+    unsigned int removed = 0;
+    unsigned int best = 0;
+    for (int n = 0; n < cells && bivalues.u128; n++) {
+        unsigned char i = bivalues.u64[0] ? _tzcnt_u64(bivalues.u64[0]) : 64 + _tzcnt_u64(bivalues.u64[1]);
+        bivalues.u128 &= bivalues.u128 - 1;
+        for (unsigned short cands = grid_state.candidates[i]; cands; cands &= cands - 1) {
+            unsigned short digit = cands & -cands;
+            DigitState probe = state;
+            if ( verbose ) {
+                stats.probes++;
+            }
+            if ( !probe.enter(_tzcnt_u32(digit), i) || !probe.propagate() ) {
+                // a failed literal
+                grid_state.candidates[i] &= ~digit;
+                grid_state.updated.set_indexbit(i);
+                removed++;
+                if ( verbose ) {
+                    stats.probe_removed++;
+                    if ( debug ) {
+                        printf("probe: %d at %s fails\n", _tzcnt_u32(digit)+1, cl2txt[i]);
+                    }
+                }
+                continue;
+            }
+            unsigned int solved = unsolved - _popcnt32(probe.unsolved[0]) - _popcnt32(probe.unsolved[1]) - _popcnt32(probe.unsolved[2]);
+            if ( solved > best ) {
+                best = solved;
+                guess_index = i;
+                guess_digit = digit;
+            }
+        }
+        if ( removed ) {
+            // propagate the removals first
+            return removed;
+        }
+    }
+    return 0;
+}
+
+// With a pool, branches of the search are offered to idle threads (parallel search).
+// With branch_of, stack[0] is such a branch of the search given by branch_of.
+// opt_sets, opt_triad_res and opt_fish select the naked sets search, the triad resolution
+// and the fish search (see -e).
+// bmi2 selects the pdep/pext kernels (see and_compress_masks).
+//
+template <bool verbose, bool avx512, bool bmi2, bool opt_sets, bool opt_triad_res, bool opt_fish>
+bool solve(signed char grid[81], GridState stack[], int line, const schoku_opts &opts, Stats &stats,
+           BranchPool *pool = 0, SearchState *branch_of = 0) {
+
+    // the options of this batch
+    const int reportstats    = opts.reportstats;
+    const int verify         = opts.verify;
+    const int unique_check   = opts.unique_check;
+    const int debug          = opts.debug;
+    const int thorough_check = opts.thorough_check;
+
+    GridState *grid_state = &stack[0];
+    unsigned long long *unlocked = grid_state->unlocked.u64;
+
+    // with opts.trail, grid_state stays at stack[0] and the trail keeps the states to back track to
+    Trail *trail = 0;
+    if ( opts.trail ) {
+        trail = get_thread_trail();
+        trail->clear();
+    }
+    // parallel search: set once a branch is offered, or at the start for a branch
+    SearchState *search = branch_of;
+    unsigned short* candidates;
+
+    // the low byte is the real count, while
+    // the high byte is increased/decreased with each guess/back track
+    // init count of resolved cells to the size of the initial set
+    unsigned short current_entered_count = 81 - _popcnt64(unlocked[0]) - _popcnt32(unlocked[1]);
+
+    [[maybe_unused]] unsigned short last_entered_count_col_triads = 0;
+
+    int unique_check_mode = 0;
+    // the solutions found (by this thread with parallel search), counted up to limit
+    const int limit = solution_limit(opts);
+    int solutions = 0;
+    // with unique_check, the level of a bi-value universal grave (if not -1)
+    // and the solutions found before it (see the solved section)
+    int bug_level = -1;
+    int bug_solutions = 0;
+
+   unsigned long long my_digits_entered_and_retracted = 0;
+   unsigned long long my_naked_sets_searched = 0;
+   unsigned char no_guess_incr = 1;
+
+    unsigned int my_past_naked_count = 0;
+ 
+    if ( verbose && debug ) {
+        printf("Line %d: %.81s\n", line, grid);
+    }
+
+    // The 'API' for code that uses the 'goto enter:' method of entering digits
+    unsigned short e_digit = 0;
+    unsigned char e_i = 0;
+
+    bool check_back = thorough_check;
+#ifdef OPT_PHASE_STATS
+    PhaseClock phase_clock(stats.phases);
+#endif
+    goto start;
+
+back:
+    PHASE_NEXT(PhaseBackTrack, PhaseBack);
+
+    // Each algorithm (naked single, hidden single, naked set)
+    // has its own non-solvability detecting trap door to detect the grid is bad.
+    // This section acts upon that detection and discards the current grid_state.
+    //    
+    if (grid_state->stackpointer == 0 || (search && search->stop)) {
+        if ( search ) {
+            // this part of the parallel search is done
+            release_search(search, stats);
+        } else if ( unique_check_mode ) {
+            if ( verbose && debug ) {
+                // no additional solution exists
+                printf("No secondary solution found during back track\n");
+            }
+        } else {
+            // This only happens when the puzzle is not valid
+            // Bypass the verbose check...
+            if ( !opts.solution_limit ) {
+                printf("Line %d: No solution found!\n", line);
+            }
+            stats.unsolved_count++;
+        }
+        if ( opts.solution_limit && !search ) {
+            report_solutions(line, solutions, limit, stats);
+        }
+        // cleanup and return
+        if ( verbose && reportstats ) {
+            stats.past_naked_count += my_past_naked_count;
+            stats.naked_sets_searched += my_naked_sets_searched;
+            stats.digits_entered_and_retracted += my_digits_entered_and_retracted;
+        }
+        PHASE_NEXT(Phases, PhaseNoProgress);
+        return true;
+    }
+
+    {
+        // the state to go back to
+        short prev_stackpointer = trail ? trail->top()->stackpointer : (grid_state-1)->stackpointer;
+        bit128_t prev_unlocked  = trail ? trail->top()->unlocked : (grid_state-1)->unlocked;
+
+        current_entered_count  = prev_stackpointer<<8;        // back to previous stack.
+        current_entered_count += _popcnt64(prev_unlocked.u64[0]) + _popcnt32(prev_unlocked.u64[1]);
+
+        // collect some guessing stats
+        if ( verbose && reportstats ) {
+            my_digits_entered_and_retracted += 
+                (_popcnt64(prev_unlocked.u64[0] & ~grid_state->unlocked.u64[0]))
+              + (_popcnt32(prev_unlocked.u64[1] & ~grid_state->unlocked.u64[1]));
+        }
+    }
+
+    // Go back to the state when the last guess was made
+    // This state had the guess removed as candidate from it's cell
+
+    if ( verbose && debug ) {
+        printf("back track to level >%d<\n", grid_state->stackpointer-1);
+    }
+    stats.trackbacks++;
+    if ( trail ) {
+        grid_state->restore_from_trail(*trail);
+    } else {
+        grid_state--;
+        if ( grid_state->given_away ) {
+            // this branch is searched by another thread
+            goto back;
+        }
+    }
+
+start:
+
+    e_digit = 0;
+
+    // at start, set everything that depends on grid_state:
+    check_back = grid_state->stackpointer || thorough_check || unique_check_mode || search;
+    if ( grid_state->stackpointer < bug_level ) {
+        // back tracked beyond the grave
+        bug_level = -1;
+    }
+
+    unlocked   = grid_state->unlocked.u64;
+    candidates = grid_state->candidates;
+
+    const __m256i ones = _mm256_set1_epi16(1);
+
+// algorithm 0:
+// Enter a digit into the solution by setting it as the value of cell and by
+// removing the cell from the set of unlocked cells.  Update all affected cells
+// by removing any now impossible candidates.
 // 
 // algorithm 1:
 // for each cell check whether it has a single candidate: enter that candidate as
@@ -1102,6 +2590,7 @@ start:
 // Below, two cases are implemented: a) cover algorithm 0 _and_ 1, or b) algorithm 1 alone.
 //
 enter:
+    PHASE_NEXT(PhaseNakedSingle, PhaseProgress);
 
     if ( e_digit ) {
         // inlined flavor of enter_digit
@@ -1161,7 +2650,7 @@ enter:
                 e_digit=0;
                 goto back;
             }
-            unsigned int mask = and_compress_masks<true>(a, grid_state->unlocked.u16[j>>4]);
+            unsigned int mask = and_compress_masks<true, bmi2>(a, grid_state->unlocked.u16[j>>4]);
             if ( mask ) {
                 dtct_m = mask;
                 dtct_j = j;
@@ -1196,36 +2685,60 @@ enter:
         e_digit = 0;
     } else {
         // no digit to enter
-        for (unsigned char i = 0; i < 80; i += 16) {
-            unsigned short m = ((bit128_t*)unlocked)->u16[i>>4];
-            if ( m ) {
-                __m256i c = _mm256_load_si256((__m256i*) &candidates[i]);
-                // remove least significant digit and compare to 0:
-                // (c & (c-1)) == 0  => naked single
-                __m256i a = _mm256_cmpeq_epi16(_mm256_and_si256(c, _mm256_sub_epi16(c, ones)), _mm256_setzero_si256());
-                // Check if any cell has zero candidates
-                if (__builtin_expect (check_back && _mm256_movemask_epi8(_mm256_cmpeq_epi16(c, _mm256_setzero_si256())),0)) {
-                    // Back track, no solutions along this path
-                    if ( verbose ) {
-                        unsigned int mx = _mm256_movemask_epi8(_mm256_cmpeq_epi16(c, _mm256_setzero_si256()));
-                        unsigned char pos = i+(_tzcnt_u32(mx)>>1);
-                        if ( grid_state->stackpointer == 0 && unique_check_mode == 0 ) {
-                            printf("Line %d: cell %s is 0\n", line, cl2txt[pos]);
-                        } else if ( debug ) {
-                            printf("back track - cell %s is 0\n", cl2txt[pos]);
-                        }
+        if constexpr (avx512) {
+            unsigned char pos;
+            Detected dtct = find_naked_single_avx512(candidates, grid_state->unlocked, check_back, pos);
+            if ( dtct == ZeroCell ) {
+                // Back track, no solutions along this path
+                if ( verbose ) {
+                    if ( grid_state->stackpointer == 0 && unique_check_mode == 0 ) {
+                        printf("Line %d: cell %s is 0\n", line, cl2txt[pos]);
+                    } else if ( debug ) {
+                        printf("back track - cell %s is 0\n", cl2txt[pos]);
                     }
-                    goto back;
                 }
-                unsigned int mask = and_compress_masks<true>(a,m);
-                if ( mask ) {
-                    int idx = _tzcnt_u32(mask)>>1;
-                    e_i = idx+i;
-                    e_digit = candidates[e_i];
-                    if ( verbose && debug ) {
-                        printf("naked  single      ");
+                goto back;
+            }
+            if ( dtct == NakedSingle ) {
+                e_i = pos;
+                e_digit = candidates[e_i];
+                if ( verbose && debug ) {
+                    printf("naked  single      ");
+                }
+                goto enter;
+            }
+        } else {
+            for (unsigned char i = 0; i < 80; i += 16) {
+                unsigned short m = ((bit128_t*)unlocked)->u16[i>>4];
+                if ( m ) {
+                    __m256i c = _mm256_load_si256((__m256i*) &candidates[i]);
+                    // remove least significant digit and compare to 0:
+                    // (c & (c-1)) == 0  => naked single
+                    __m256i a = _mm256_cmpeq_epi16(_mm256_and_si256(c, _mm256_sub_epi16(c, ones)), _mm256_setzero_si256());
+                    // Check if any cell has zero candidates
+                    if (__builtin_expect (check_back && _mm256_movemask_epi8(_mm256_cmpeq_epi16(c, _mm256_setzero_si256())),0)) {
+                        // Back track, no solutions along this path
+                        if ( verbose ) {
+                            unsigned int mx = _mm256_movemask_epi8(_mm256_cmpeq_epi16(c, _mm256_setzero_si256()));
+                            unsigned char pos = i+(_tzcnt_u32(mx)>>1);
+                            if ( grid_state->stackpointer == 0 && unique_check_mode == 0 ) {
+                                printf("Line %d: cell %s is 0\n", line, cl2txt[pos]);
+                            } else if ( debug ) {
+                                printf("back track - cell %s is 0\n", cl2txt[pos]);
+                            }
+                        }
+                        goto back;
+                    }
+                    unsigned int mask = and_compress_masks<true, bmi2>(a,m);
+                    if ( mask ) {
+                        int idx = _tzcnt_u32(mask)>>1;
+                        e_i = idx+i;
+                        e_digit = candidates[e_i];
+                        if ( verbose && debug ) {
+                            printf("naked  single      ");
+                        }
+                        goto enter;
                     }
-                    goto enter;
                 }
             }
         }
@@ -1260,57 +2773,48 @@ enter:
     // Check if it's solved, if it ever gets solved it will be solved after looking for naked singles
     if ( *(__uint128_t*)unlocked == 0) {
         // Solved it
-        if ( unique_check == 1 && unique_check_mode == 1 ) {
-            if ( !nonunique_reported ) {
-                if ( verbose && reportstats ) {
-                    printf("Line %d: solution to puzzle is not unique\n", line);
+        // The cells of a bi-value universal grave all have two candidates, each digit of a section
+        // in two of its cells.  The other candidates of a solution below the grave are another solution.
+        // Its first solution counts as two then, if that reaches the limit (otherwise the twin is
+        // still to be found).
+        int found = 1;
+        if ( bug_level >= 0 ) {
+            if ( solutions == bug_solutions && solutions+2 == limit && search == 0 ) {
+                found = 2;
+                if ( verbose && debug ) {
+                    printf("solution below a bi-value universal grave, counted with its twin\n");
                 }
-                non_unique_count++;
-                nonunique_reported = true;
             }
+            bug_level = -1;
+        }
+        solutions += found;
+        int n = solutions;
+        if ( search ) {
+            // parallel search: the first solution is entered, the count stops at the limit
+            n = ++search->solutions;
+            if ( n > limit ) {
+                goto back;
+            }
+            if ( n == limit ) {
+                search->stop = true;
+            }
+            unique_check_mode = n > 1;
+        }
+        if ( unique_check == 1 && n >= 2 && n-found < 2 ) {
+            if ( verbose && reportstats && !opts.solution_limit ) {
+                printf("Line %d: solution to puzzle is not unique\n", line);
+            }
+            stats.non_unique_count++;
         }
         if ( verify ) {
             // quickly assert that the solution is valid
-            // no cell has more than one digit set
-            // all rows, columns and boxes have all digits set.
-
-            const __m256i mask9 { -1LL, -1LL, 0xffffLL, 0 };
-            const __m256i ones = _mm256_and_si256(_mm256_set1_epi16(1), mask9);
-            __m256i rowx;
-            __m256i colx;
-            __m256i boxx;
-            boxx = colx = rowx = _mm256_and_si256(_mm256_set1_epi16(0x1ff),mask9);
-            __m256i uniq = _mm256_setzero_si256();
-
-            for (unsigned char i = 0; i < 9; i++) {
-                // load element i of 9 rows
-                __m256i row = _mm256_set_epi16(0, 0, 0, 0, 0, 0, 0, candidates[i+72],
-                              candidates[i+63], candidates[i+54], candidates[i+45], candidates[i+36], candidates[i+27], candidates[i+18], candidates[i+9], candidates[i]);
-                rowx = _mm256_xor_si256(rowx,row);
-
-                // load element i of 9 columns
-                __m256i col = _mm256_and_si256(*(__m256i_u*) &candidates[i*9], mask9);
-                colx = _mm256_xor_si256(colx,col);
-
-                uniq = _mm256_or_si256(_mm256_and_si256(col, _mm256_sub_epi16(col, ones)),uniq);
-
-                // load element i of 9 boxes
-                int bi = i%3+i/3*9; // starting in box 0
-                __m256i box = _mm256_set_epi16(0, 0, 0, 0, 0, 0, 0, candidates[bi+60],
-                              candidates[bi+57], candidates[bi+54], candidates[bi+33], candidates[bi+30], candidates[bi+27], candidates[bi+6], candidates[bi+3], candidates[bi]);
-                boxx = _mm256_xor_si256(boxx,box);
-           }
-
-           __m256i res = _mm256_or_si256(rowx,colx);
-           res = _mm256_or_si256(res, boxx);
-           res = _mm256_or_si256(res, uniq);
-           if ( ~_mm256_movemask_epi8(_mm256_cmpeq_epi16(res,_mm256_setzero_si256()))) {
+           if ( !verify_solution(candidates) ) {
                 if ( unique_check_mode == 0 ) {
                     if ( verbose ) {
                            printf("Line %d: solution to puzzle failed verification\n", line);
                     }
-                    unsolved_count++;
-                    not_verified_count++;
+                    stats.unsolved_count++;
+                    stats.not_verified_count++;
                 } else {     // not supposed to get here
                     if ( verbose ) {
                         printf("unique check: not a valid solution\n");
@@ -1320,13 +2824,13 @@ enter:
                if ( debug ) {
                    printf("Solution found and verified\n");
                }
-               if ( reportstats ) {
-                   solved_count++;
-                   verified_count++;
+               if ( reportstats && unique_check_mode == 0 ) {
+                   stats.solved_count++;
+                   stats.verified_count++;
                }
            }
-        } else if ( verbose && reportstats ) {
-           solved_count++;
+        } else if ( verbose && reportstats && unique_check_mode == 0 ) {
+           stats.solved_count++;
         }
 
         // Enter found digits into grid (unless we already had a solution)
@@ -1335,12 +2839,12 @@ enter:
                 grid[j] = 49+_tzcnt_u32(candidates[j]);
             }
         }
-        if ( verbose && reportstats ) {
-            no_guess_cnt += no_guess_incr;
+        if ( verbose && reportstats && unique_check_mode == 0 ) {
+            stats.no_guess_cnt += no_guess_incr;
         }
 
         if ( unique_check == 1 ) {
-            if ( grid_state->stackpointer ) {
+            if ( grid_state->stackpointer && n < limit ) {
                 if ( verbose && debug && unique_check_mode) {
                     printf("back track during unique check (OK)\n");
                 }
@@ -1350,17 +2854,28 @@ enter:
                 unique_check_mode = 1;
                 goto back;
             }
-            // otherwise uniqueness is verified
+            // otherwise uniqueness is verified, or the limit is reached
+        }
+        if ( opts.solution_limit && !search ) {
+            report_solutions(line, n, limit, stats);
         }
         if ( verbose && reportstats ) {
-            past_naked_count += my_past_naked_count;
-            naked_sets_searched += my_naked_sets_searched;
-            digits_entered_and_retracted += my_digits_entered_and_retracted;
+            stats.past_naked_count += my_past_naked_count;
+            stats.naked_sets_searched += my_naked_sets_searched;
+            stats.digits_entered_and_retracted += my_digits_entered_and_retracted;
         }
+        if ( search ) {
+            if ( unique_check == 0 ) {
+                search->stop = true;
+            }
+            release_search(search, stats);
+        }
+        PHASE_NEXT(Phases, PhaseProgress);
         return true;
     }
 
     my_past_naked_count++;
+    PHASE_NEXT(PhaseHiddenSingle, PhaseNoProgress);
 
     // Algorithm 2 - Find hidden singles
     // For all sections (ie. rows/columns/boxes):
@@ -1470,6 +2985,8 @@ enter:
 
     // Algo 2 and Algo 3.1
     {
+        // the selected hidden singles come as 2 bits per cell (AVX2) or 1 bit per cell (AVX-512)
+        const int mask_shift = avx512 ? 0 : 1;
         const __m256i mask11hi { 0LL, 0LL, 0xffffLL<<48, ~0LL };
         const __m256i mask1ff { 0x1ff01ff01ff01ffLL, 0x1ff01ff01ff01ffLL, 0x1ff01ff01ff01ffLL, 0x1ff01ff01ff01ffLL };
 
@@ -1538,10 +3055,15 @@ enter:
                             if ( j > 64-9) {
                                 m |= unlocked[1] << (64-j);
                             }
-                            __m256i a = _mm256_cmpgt_epi16(column_mask_neg, _mm256_setzero_si256());
-                            unsigned int mask = and_compress_masks<true>(a, m & 0x1ff);
+                            unsigned int mask;
+                            if constexpr (avx512) {
+                                mask = select_nonzero_avx512(column_mask_neg, m & 0x1ff);
+                            } else {
+                                __m256i a = _mm256_cmpgt_epi16(column_mask_neg, _mm256_setzero_si256());
+                                mask = and_compress_masks<true, bmi2>(a, m & 0x1ff);
+                            }
                             if (mask) {
-                                int idx = __tzcnt_u32(mask)>>1;
+                                int idx = __tzcnt_u32(mask)>>mask_shift;
                                 e_i = j+idx;
                                 e_digit = ((v16us)column_mask_neg)[idx];
                                 if ( e_digit & (e_digit-1) ) {
@@ -1708,10 +3230,15 @@ enter:
 
                 // check row/col (9) candidates
                 unsigned short m = grid_state->unlocked.get_indexbits(i, 9);
-                __m256i a = _mm256_cmpgt_epi16(or_mask, _mm256_setzero_si256());
-                unsigned int mask = and_compress_masks<true>(a, m & 0x1ff);
+                unsigned int mask;
+                if constexpr (avx512) {
+                    mask = select_nonzero_avx512(or_mask, m & 0x1ff);
+                } else {
+                    __m256i a = _mm256_cmpgt_epi16(or_mask, _mm256_setzero_si256());
+                    mask = and_compress_masks<true, bmi2>(a, m & 0x1ff);
+                }
                 while (mask) {
-                    int idx = __tzcnt_u32(mask)>>1;
+                    int idx = __tzcnt_u32(mask)>>mask_shift;
                     if ( verbose && debug ) {
                         bool is_col = ((v16us)column_mask)[idx] == ((v16us)or_mask)[idx];
                         printf("hidden single (%s)", is_col?"col":"row");
@@ -1725,10 +3252,16 @@ enter:
                 // we have already taken care of rows together with columns.
                 // now look at the box.
                 // First the (8) candidates, in the high half of rowbox_mask.
-                __m256i a = _mm256_cmpgt_epi16(rowbox_mask, _mm256_setzero_si256());
-                unsigned int mask = and_compress_masks<true>(a, (get_contiguous_masked_indices_for_box(unlocked,irow)&0xff)<<8);
+                unsigned int mask;
+                unsigned short box_unlocked = (get_contiguous_masked_indices_for_box<bmi2>(unlocked,irow)&0xff)<<8;
+                if constexpr (avx512) {
+                    mask = select_nonzero_avx512(rowbox_mask, box_unlocked);
+                } else {
+                    __m256i a = _mm256_cmpgt_epi16(rowbox_mask, _mm256_setzero_si256());
+                    mask = and_compress_masks<true, bmi2>(a, box_unlocked);
+                }
                 while (mask) {
-                    int s_idx = __tzcnt_u32(mask)>>1;
+                    int s_idx = __tzcnt_u32(mask)>>mask_shift;
                     int c_idx = b + box_offset[s_idx&7];
                     unsigned short digit = ((v16us)rowbox_mask)[s_idx];
                     if ( verbose && debug ) {
@@ -1770,8 +3303,9 @@ enter:
         }   // for
     } // Algo 2 and Algo 3.1
 
-#ifdef OPT_TRIAD_RES
-    { // Algo 3.3
+    PHASE_NEXT(PhaseTriads, PhaseNoProgress);
+
+    if constexpr ( opt_triad_res ) { // Algo 3.3
         const __m256i mask27 { -1LL, (long long int)0xffffffffffff00ffLL, (long long int)0xffffffff00ffffffLL, 0xffffffffffLL };
 
         const __m256i low_mask  = _mm256_set1_epi8 ( 0x0f );
@@ -1808,7 +3342,7 @@ enter:
                 unsigned long long tr = unlocked[0];  // col triads - set if any triad cell is unlocked
                 tr |= (tr >> 9) | (tr >> 18) | (unlocked[1]<<(64-9)) | (unlocked[1]<<(64-18));
                 // mimick the pattern of col_triads, i.e. a gap of 1 after each group of 9.
-                if ( bmi2_support ) {
+                if constexpr ( bmi2 ) {
                     tr = _pext_u64(tr, 0x1ffLL | (0x1ffLL<<27) | (0x1ffLL<<54));
                     grid_state->triads_unlocked[Col] &= _pdep_u64(tr, (0x1ff)|(0x1ff<<10)|(0x1ff<<20));
                 } else {
@@ -1831,7 +3365,7 @@ enter:
                 unsigned char off = tidx%10+tidx/10*27;
                 grid_state->set23_found[Col].set_indexbits(0x40201,off,19);
                 grid_state->set23_found[Box].set_indexbits(0x40201,off,19);
-                triads_resolved++;
+                stats.triads_resolved++;
             }
         
             // A3.2.2 (check row-triads)
@@ -1888,13 +3422,12 @@ enter:
                 grid_state->triads_unlocked[Row] &= ~(1LL << tidx);
                 grid_state->set23_found[Row].set_indexbits(0x7,off,3);
                 grid_state->set23_found[Box].set_indexbits(0x7,off,3);
-                triads_resolved++;
+                stats.triads_resolved++;
             } // while
-    }   // Algo 3 Part 3
-#else
-    // by default, all triads will be checked
-    triad_info.triads_selection[Col] = triad_info.triads_selection[Row] = 0x1ff | (0x1ff<<10) | (0x1ff<<20);
-#endif
+    } else {
+        // without triad resolution, all triads will be checked
+        triad_info.triads_selection[Col] = triad_info.triads_selection[Row] = 0x1ff | (0x1ff<<10) | (0x1ff<<20);
+    }
 
 
 
@@ -2062,7 +3595,7 @@ enter:
                 __m256i tmp = _mm256_cmpgt_epi16(to_remove_v,_mm256_setzero_si256());
 
                 // m repesents all triad indices to update
-                unsigned long long m = compress_epi16_boolean(tmp);
+                unsigned long long m = compress_epi16_boolean<false, bmi2>(tmp);
                 if ( m ) {
                     any_changes = true;
                 }
@@ -2134,7 +3667,7 @@ enter:
                         } else {
                             rslvd_col_combo_tpos |= 0x40201<<i_rel;
                         }
-                        triads_resolved++;
+                        stats.triads_resolved++;
                     }
                     if ( verbose && debug ) {
                         char ret[32];
@@ -2142,7 +3675,7 @@ enter:
                         printf("%s triad update \\%-5s at %s\n", type == 0? "row":"col",
                                ret, cl2txt[type==0?row_triad_canonical_map[ltidx]*3:col_canonical_triad_pos[ltidx]] );
                     }
-                    triad_updates++;
+                    stats.triad_updates++;
                 }
                 if ( type == 1 ) {
                     if ( rslvd_col_combo_tpos ) {
@@ -2170,7 +3703,6 @@ enter:
         }
     }
 
-#ifdef OPT_SETS
 
 // Algorithm 4 - Find naked sets
 // For each possible combination of candidates of size K, check for every section
@@ -2208,7 +3740,9 @@ enter:
 // - previously found sets (and their complements) as well as found triads
 // - sets that occupy all available space (minus one) - impossible due to perfect single detection
 
-    {
+    if constexpr ( opt_sets ) {
+        PHASE_NEXT(PhaseNakedSets, PhaseNoProgress);
+
         bool found = false;
 
         // visit only the changed (updated) cells
@@ -2254,7 +3788,7 @@ enter:
                         if (check_back || (cnt+2 <= ul) ) {
                             my_naked_sets_searched++;
                             res = _mm_cmpeq_epi16(_mm256_castsi256_si128(a_i), _mm_or_si128(_mm256_castsi256_si128(a_i), *(__m128i_u*) &candidates[9*ri]));
-                            unsigned int m = compress_epi16_boolean128(res);
+                            unsigned int m = compress_epi16_boolean128<false, bmi2>(res);
                             bool bit9 = candidates[i] == (candidates[i] | candidates[9*ri+8]);
                             if ( bit9 ) {
                                 m |= 1<<8;    // fake the 9th mask position
@@ -2282,7 +3816,7 @@ enter:
                                     grid_state->set23_found[Row].set_indexbits(~m&0x1ff,ri*9,9);
                                 }
                                 if (cnt+2 <= ul) {
-                                    naked_sets_found++;
+                                    stats.naked_sets_found++;
                                     add_indices<Row>((bit128_t*)to_change, i);
                                     if ( verbose && debug ) {
                                         if ( cnt <=3 || cnt+3 < ul ) {
@@ -2340,7 +3874,7 @@ enter:
                             __m256i a_j_256 = _mm256_set_epi16(candidates[b+19], candidates[b+18], candidates[b+11], candidates[b+10], candidates[b+9], candidates[b+2], candidates[b+1], candidates[b],
                                               candidates[ci+63], candidates[ci+54], candidates[ci+45], candidates[ci+36], candidates[ci+27], candidates[ci+18], candidates[ci+9], candidates[ci]);
                             __m256i res256 = _mm256_cmpeq_epi16(a_i, _mm256_or_si256(a_i, a_j_256));
-                            unsigned int ms[2] = { compress_epi16_boolean<true>(res256), 0 };
+                            unsigned int ms[2] = { compress_epi16_boolean<true, bmi2>(res256), 0 };
                             ms[1] = ms[0] >> 16;
                             ms[0] &= 0xffff;
                             bool bit9s[2];
@@ -2383,7 +3917,7 @@ enter:
                                 // while having to manage set23_found bit by bit.
                                 //
                                 if ( (ss[j] == cnt) && (cnt+2 <= uls[j]) ) {
-                                    naked_sets_found++;
+                                    stats.naked_sets_found++;
                                     if ( j ) {
                                         add_indices<Box>((bit128_t*)to_change, i);
                                     } else {
@@ -2489,38 +4023,40 @@ enter:
         to_visit_n.u128 |= to_visit_again.u128;
         grid_state->updated.u128 = to_visit_n.u128;
     }
-#endif
 
+    PHASE_NEXT(PhaseBUG, PhaseNoProgress);
     bit128_t bivalues {};
-    {
-        __m256i c;
-        for (unsigned char i = 0; i < 64; i += 32) {
-            c = _mm256_load_si256((__m256i*) &candidates[i]);
-            __m256i c2 = _mm256_load_si256((__m256i*) &candidates[i+16]);
+    if constexpr (avx512) {
+        bivalues = get_bivalues_avx512(candidates);
+    } else {
+            __m256i c;
+            for (unsigned char i = 0; i < 64; i += 32) {
+                c = _mm256_load_si256((__m256i*) &candidates[i]);
+                __m256i c2 = _mm256_load_si256((__m256i*) &candidates[i+16]);
+                __m256i lsb  = get_first_lsb(c);
+                __m256i lsb2  = get_first_lsb(c2);
+                lsb = andnot_get_next_lsb(lsb, c);
+                lsb2 = andnot_get_next_lsb(lsb2, c2);
+                // check whether lsb is the last bit
+                // count the twos
+                bivalues.u32[i>>5] = 
+                    compress_epi16_boolean<false>(_mm256_and_si256(
+                                          _mm256_cmpgt_epi16(c,_mm256_setzero_si256()),
+                                          _mm256_cmpeq_epi16(lsb,c)),
+                                          _mm256_and_si256(
+                                          _mm256_cmpgt_epi16(c2,_mm256_setzero_si256()),
+                                          _mm256_cmpeq_epi16(lsb2,c2)));
+            }
+            c = _mm256_load_si256((__m256i*) &candidates[64]);
             __m256i lsb  = get_first_lsb(c);
-            __m256i lsb2  = get_first_lsb(c2);
             lsb = andnot_get_next_lsb(lsb, c);
-            lsb2 = andnot_get_next_lsb(lsb2, c2);
             // check whether lsb is the last bit
             // count the twos
-            bivalues.u32[i>>5] = 
-                compress_epi16_boolean<false>(_mm256_and_si256(
-                                      _mm256_cmpgt_epi16(c,_mm256_setzero_si256()),
-                                      _mm256_cmpeq_epi16(lsb,c)),
-                                      _mm256_and_si256(
-                                      _mm256_cmpgt_epi16(c2,_mm256_setzero_si256()),
-                                      _mm256_cmpeq_epi16(lsb2,c2)));
-        }
-        c = _mm256_load_si256((__m256i*) &candidates[64]);
-        __m256i lsb  = get_first_lsb(c);
-        lsb = andnot_get_next_lsb(lsb, c);
-        // check whether lsb is the last bit
-        // count the twos
-        bivalues.u16[4] = compress_epi16_boolean<false>(_mm256_and_si256(
-                                 _mm256_cmpgt_epi16(c,_mm256_setzero_si256()),
-                                 _mm256_cmpeq_epi16(lsb,c)));
-
-        bivalues.u16[5] = (__popcnt16(candidates[80]) == 2)?1:0;
+            bivalues.u16[4] = compress_epi16_boolean<false, bmi2>(_mm256_and_si256(
+                                     _mm256_cmpgt_epi16(c,_mm256_setzero_si256()),
+                                     _mm256_cmpeq_epi16(lsb,c)));
+
+            bivalues.u16[5] = (__popcnt16(candidates[80]) == 2)?1:0;
         // bivalues is now set for subsequent steps
     }
 
@@ -2543,87 +4079,2509 @@ enter:
                 unsigned char sum12s = 0;   // count P, the number of bi-values + the number of locked cells
                 unsigned char target = 0;   // the index of the only cell with three candidates
 
-                // track wether there was a single cell with count > 2
-                // if there is a second such cell, goto guess
-                unsigned char not_pairs = 0;
+                // track wether there was a single cell with count > 2
+                // if there is a second such cell, goto guess
+                unsigned char not_pairs = 0;
+
+                for (unsigned char i = 0; i < 2; i++) {
+                    unsigned long long m = ~((bit128_t*)unlocked)->u64[i];
+                    if ( m ) {
+                        m |= bivalues.u64[i];
+                        unsigned char pc = __popcnt64(m);
+                        sum12s += pc;
+                        if ( pc != 64 ) {
+                            if ( pc < 63 || not_pairs++ ) {
+                                goto guess;
+                            }
+                            target = (i<<6) + __tzcnt_u64(~m);
+                        }
+                    }
+                }
+                // sum12s is the total of 128 bits minus the ones that are neither 1 or 2
+                sum12s -= (64-17);    // only 81 possible bits, subtract 64-17 to compensate
+                if ( sum12s == 81 ) { // this means Q == 0
+                    if ( unique_check ) {
+                        if ( verbose && debug ) {
+                            printf("bi-value universal grave means at least two solutions exist.\n");
+                        }
+                        if ( bug_level < 0 && search == 0 ) {
+                            bug_level = grid_state->stackpointer;
+                            bug_solutions = solutions;
+                        }
+                        goto guess;
+                    } else if ( grid_state->stackpointer ) {
+                        if ( verbose && debug ) {
+                            printf("back track - found a bi-value universal grave.\n");
+                        }
+                        goto back;
+                    } else {
+                        if ( verbose && debug ) {
+                            printf("bi-value universal grave means at least two solutions exist.\n");
+                            stats.non_unique_count++;
+                        }
+                        goto guess;
+                    }
+                }
+
+                // the pivot assumes a unique solution, not when counting the solutions
+                if ( sum12s == 80 && !unique_check && __popcnt16(candidates[target]) == 3 ) {
+                    unsigned char row = row_index[target];
+                    unsigned short cand3 = candidates[target];
+                    unsigned short digit = 0;
+                    unsigned short mask = ((bit128_t*)unlocked)->get_indexbits(row*9,9);
+                    __m256i maskv = expand_bitvector(mask);
+                    __m256i c = _mm256_and_si256(_mm256_load_si256((__m256i*) &candidates[row*9]), maskv);
+                    while (cand3) {
+                        unsigned short canddigit = cand3 & (-cand3);
+                        // count cells with this candidate digit:
+                        __m256i tmp = _mm256_and_si256(_mm256_set1_epi16(canddigit), c);
+                        // as a boolean
+                        tmp = _mm256_cmpeq_epi16(tmp,_mm256_setzero_si256());
+                        // need three cell, doubled bits in mask:
+                        if ( _popcnt32(~_mm256_movemask_epi8(tmp)) == 3*2 ) {
+                            digit = canddigit;
+                            break;
+                        };
+                        cand3 &= ~canddigit;
+                    }
+                    if ( digit ) {
+                        stats.bug_count++;
+                        if ( verbose && debug ) {
+                            printf("bi-value universal grave pivot:");
+                        }
+                        e_i = target;
+                        e_digit = digit;
+                        goto enter;
+                    }
+                }
+        }
+    }
+
+guess:
+    if constexpr ( opt_fish ) {
+        PHASE_NEXT(PhaseFish, PhaseNoProgress);
+        if ( eliminate_fish<verbose, avx512, bmi2>(candidates, grid_state->unlocked, grid_state->updated, debug, stats) ) {
+            goto start;
+        }
+    }
+    if ( opts.engine == SCHOKU_ENGINE_HYBRID && no_guess_incr && search == 0 ) {
+        // hybrid engine: the digit-major engine searches from here
+        PHASE_NEXT(Phases, PhaseNoProgress);
+        if ( verbose && debug ) {
+            printf("digit-major search\n");
+        }
+        if ( verbose && reportstats ) {
+            stats.past_naked_count += my_past_naked_count;
+            stats.naked_sets_searched += my_naked_sets_searched;
+        }
+        DigitState digit_state;
+        digit_state.initialize(*grid_state);
+        solve_digits<verbose>(digit_state, grid, line, opts, stats);
+        return true;
+    }
+    if ( opts.probe ) {
+        PHASE_NEXT(PhaseProbe, PhaseNoProgress);
+        unsigned char guess_index;
+        unsigned short guess_digit;
+        if ( probe_guesses<verbose>(*grid_state, bivalues, opts.probe, debug, stats, guess_index, guess_digit) ) {
+            goto start;
+        }
+        if ( guess_digit ) {
+            PHASE_NEXT(PhaseGuess, PhaseNoProgress);
+            if ( search && search->stop ) {
+                goto back;
+            }
+            // the branch with the most propagation
+            bit128_t guess_cell {};
+            guess_cell.set_indexbit(guess_index);
+            grid_state = grid_state->make_guess<verbose>(guess_cell, debug, trail, guess_digit);
+            goto guessed;
+        }
+    }
+    PHASE_NEXT(PhaseGuess, PhaseNoProgress);
+
+    if ( search && search->stop ) {
+        goto back;
+    }
+    // Make a guess if all that didn't work
+    grid_state = grid_state->make_guess<verbose, opt_triad_res>(triad_info, bivalues, debug, trail);
+guessed:
+    stats.guesses++;
+    current_entered_count += 0x101;     // increment high byte for the new grid_state, plus one for the guess made.
+    no_guess_incr = 0;
+
+    if ( pool && trail == 0 && pool->idle ) {
+        // parallel search: offer the lowest level that is not given away yet
+        for (GridState *gs = stack; gs < grid_state; gs++) {
+            if ( gs->given_away == 0 ) {
+                if ( search == 0 ) {
+                    search = new SearchState(grid, line, solutions, limit, opts.solution_limit != 0);
+                }
+                pool->offer(*gs, search);
+                gs->given_away = 1;
+                break;
+            }
+        }
+    }
+    goto start;
+
+}
+
+// solve_avx512
+// The AVX-512 instantiation of solve.
+// flatten has the AVX-512 kernels (and anything else) inlined into this function,
+// which has the AVX-512 target.
+// All CPUs with AVX-512 have fast pdep/pext.
+//
+#ifdef SCHOKU_SIMD_AVX2
+template <bool verbose, bool opt_sets, bool opt_triad_res, bool opt_fish>
+TARGET_AVX512 __attribute__((flatten)) bool solve_avx512(signed char grid[81], GridState stack[], int line, const schoku_opts &opts, Stats &stats,
+                                                        BranchPool *pool, SearchState *branch_of) {
+    return solve<verbose,true,true,opt_sets,opt_triad_res,opt_fish>(grid, stack, line, opts, stats, pool, branch_of);
+}
+#endif
+
+// Solver
+// an instantiation of solve (or solve_avx512).
+//
+typedef bool (*Solver)(signed char grid[81], GridState stack[], int line, const schoku_opts &opts, Stats &stats,
+                       BranchPool *pool, SearchState *branch_of);
+
+// the strategies without SCHOKU_STRATEGY_SELECTED, as compiled
+const int default_strategies = 0
+#ifdef OPT_TRIAD_RES
+    | SCHOKU_STRATEGY_TRIAD_RES
+#endif
+#ifdef OPT_SETS
+    | SCHOKU_STRATEGY_SETS
+#endif
+#ifdef OPT_FISH
+    | SCHOKU_STRATEGY_FISH
+#endif
+    ;
+
+// The AVX2 code path comes with (Intel, AMD Zen3 and later) and without pdep/pext (AMD Zen2),
+// as decided once by schoku_init (bmi2_support).
+template <bool verbose, bool opt_sets, bool opt_triad_res, bool opt_fish>
+inline Solver get_solver(bool avx512) {
+#ifdef SCHOKU_SIMD_AVX2
+    return avx512 ? solve_avx512<verbose,opt_sets,opt_triad_res,opt_fish>
+         : bmi2_support ? solve<verbose,false,true,opt_sets,opt_triad_res,opt_fish>
+         : solve<verbose,false,false,opt_sets,opt_triad_res,opt_fish>;
+#else
+    // neither AVX-512 nor pdep/pext with the other backends
+    (void)avx512;
+    return solve<verbose,false,false,opt_sets,opt_triad_res,opt_fish>;
+#endif
+}
+
+template <bool verbose>
+Solver get_solver(bool avx512, int strategies) {
+    switch ( strategies & STRATEGY_MASK ) {
+    case 0:
+        return get_solver<verbose,false,false,false>(avx512);
+    case SCHOKU_STRATEGY_TRIAD_RES:
+        return get_solver<verbose,false,true,false>(avx512);
+    case SCHOKU_STRATEGY_SETS:
+        return get_solver<verbose,true,false,false>(avx512);
+    case SCHOKU_STRATEGY_SETS|SCHOKU_STRATEGY_TRIAD_RES:
+        return get_solver<verbose,true,true,false>(avx512);
+    case SCHOKU_STRATEGY_FISH:
+        return get_solver<verbose,false,false,true>(avx512);
+    case SCHOKU_STRATEGY_FISH|SCHOKU_STRATEGY_TRIAD_RES:
+        return get_solver<verbose,false,true,true>(avx512);
+    case SCHOKU_STRATEGY_FISH|SCHOKU_STRATEGY_SETS:
+        return get_solver<verbose,true,false,true>(avx512);
+    default:
+        return get_solver<verbose,true,true,true>(avx512);
+    }
+}
+
+// the instantiation of solve for the given strategies (SCHOKU_STRATEGY_TRIAD_RES | SCHOKU_STRATEGY_SETS | SCHOKU_STRATEGY_FISH)
+Solver get_solver(bool verbose, bool avx512, int strategies) {
+    return verbose ? get_solver<true>(avx512, strategies) : get_solver<false>(avx512, strategies);
+}
+
+// The GridState stack is allocated for each thread once and separately.
+// It is kept for all later batches solved by the same (OMP pool) thread.
+// In NUMA mode, a thread gets a new stack on the node it is bound to (see set_thread_stack_node).
+//
+static thread_local GridState *thread_stack = 0;
+static thread_local void *thread_stack_block = 0;    // the malloc block of get_thread_stack
+static thread_local int thread_stack_node = -1;
+
+// allocate the stack of this thread on the given node, the thread is bound to it,
+// free the previous stack and move the trail to the node as well.
+inline void set_thread_stack_node(int node) {
+    if ( thread_stack_node != node ) {
+        // mmap for fresh pages, placed by the first touch of this thread
+        void *p = mmap((void*)0, sizeof(GridState)*GRIDSTATE_MAX, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if ( p == MAP_FAILED ) {
+            fprintf(stderr, "Error allocating the GridState stack: %s\n", strerror(errno));
+            exit(1);
+        }
+        memset(p, 0, sizeof(GridState)*GRIDSTATE_MAX);
+        if ( thread_stack_node >= 0 ) {
+            munmap(thread_stack, sizeof(GridState)*GRIDSTATE_MAX);
+        } else {
+            free(thread_stack_block);
+            thread_stack_block = 0;
+        }
+        thread_stack = (GridState *)p;
+        thread_stack_node = node;
+        get_thread_trail()->rehome();
+    }
+}
+
+inline GridState *get_thread_stack() {
+    if ( thread_stack == 0 ) {
+        // force alignment the 'old-fashioned' way
+        // freed only when the thread changes its NUMA node
+        // stack = (GridState*)malloc(sizeof(GridState)*GRIDSTATE_MAX);
+        thread_stack_block = malloc(sizeof(GridState)*GRIDSTATE_MAX+0x40);
+        thread_stack = (GridState*) (~0x3fll & ((unsigned long long) thread_stack_block+0x40));
+    }
+    return thread_stack;
+}
+
+// the digit of a cell of a grid, 0 if there is none
+inline unsigned char cell_digit(signed char c) {
+    return (c > '0' && c <= '9') ? c - '0' : 0;
+}
+
+// pack a grid into 41 bytes (SCHOKU_OUTPUT_PACKED)
+inline void pack_grid(const signed char grid[81], signed char packed[41]) {
+    for (unsigned char j = 0; j < 80; j += 2) {
+        packed[j>>1] = (cell_digit(grid[j]) << 4) | cell_digit(grid[j+1]);
+    }
+    packed[40] = cell_digit(grid[80]) << 4;
+}
+
+extern "C" size_t schoku_record_size(int output_format) {
+    switch ( output_format ) {
+    case SCHOKU_OUTPUT_SOLUTION:
+        return 82;
+    case SCHOKU_OUTPUT_PACKED:
+        return 41;
+    default:
+        return 164;
+    }
+}
+
+// copy a puzzle into grid, any character other than a digit becomes a '.'
+inline void copy_puzzle(signed char grid[81], const signed char *puzzle) {
+    const __m256i below = _mm256_set1_epi8('0'-1);
+    const __m256i above = _mm256_set1_epi8('9'+1);
+    const __m256i dots  = _mm256_set1_epi8('.');
+    // 81 = 32+32+17, the last part overlaps the second
+    for (unsigned char j : { 0, 32, 49 }) {
+        __m256i c = _mm256_loadu_si256((__m256i_u*) &puzzle[j]);
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, below), _mm256_cmpgt_epi8(above, c));
+        _mm256_storeu_si256((__m256i_u*) &grid[j], _mm256_blendv_epi8(dots, c, digit));
+    }
+}
+
+// the number of clues of a puzzle, a cheap estimate of how hard it is
+inline unsigned char clue_count(const signed char *puzzle) {
+    unsigned char cnt = 0;
+    for (unsigned char j = 0; j < 81; j++) {
+        cnt += puzzle[j] > '0' && puzzle[j] <= '9';
+    }
+    return cnt;
+}
+
+// the order of solving for SCHOKU_SCHEDULE_HARDEST_FIRST:
+// the puzzles with the fewest clues first, otherwise in input order (counting sort).
+std::vector<unsigned int> hardest_first_order(const signed char *in, size_t n, const size_t *index) {
+    std::vector<unsigned char> clues(n);
+    unsigned int start[82+1] = {0};
+    for (size_t k = 0; k < n; k++) {
+        clues[k] = clue_count(index ? &in[index[k]] : &in[k*82]);
+        start[clues[k]+1]++;
+    }
+    for (int c = 0; c < 82; c++) {
+        start[c+1] += start[c];
+    }
+    std::vector<unsigned int> order(n);
+    for (size_t k = 0; k < n; k++) {
+        order[start[clues[k]]++] = k;
+    }
+    return order;
+}
+
+// Solution cache (-m#)
+// Puzzles that are equivalent under digit relabeling, row permutations within bands,
+// column permutations within stacks, band and stack permutations and transposition
+// are mapped to the same canonical form, which is the key of the cache.
+// A hit maps the cached canonical solution back to the puzzle instead of solving it.
+//
+// The canonical form:
+// Rows and columns get keys that don't change under these transformations
+// (the number of clues, the clues per stack/band and the clue counts of the crossing lines).
+// Bands and stacks, and the rows and columns within them, are ordered by these keys,
+// and if both orientations have the same keys, both are considered.
+// Each ordering gives a puzzle with the digits numbered by order of appearance,
+// the smallest of which is the canonical form.
+// Elements with equal keys can be ordered in all possible ways.  If there are more than
+// CANON_MAX_ORDERINGS such orderings, only the first one (by position) is used: the result
+// is still a valid key, but equivalent puzzles may get a different one (a cache miss).
+//
+#define CANON_MAX_ORDERINGS 64
+
+// the transformation of a puzzle to its canonical form
+struct CanonTransform {
+    unsigned char cell[81];    // the canonical cell k is the puzzle's cell cell[k]
+    unsigned char digit[10];   // the canonical digit of a digit of the puzzle, 0 for 0
+};
+
+// the ordering of the rows of a puzzle (or the columns for the transposed puzzle)
+struct LineOrder {
+    unsigned char band[3];     // the bands in canonical order
+    unsigned char row[3][3];   // the rows of each band in canonical order
+};
+
+// a run (of elements with equal keys) that can be permuted
+struct OrderRun {
+    unsigned char *first;
+    unsigned char len;
+};
+
+// key of line (row) r of v: the number of clues, the clue counts per box (sorted)
+// and the histogram of the clue counts of the crossing lines of its clues.
+inline unsigned long long line_key(const unsigned char v[81], int r, const unsigned char cross_cnt[9]) {
+    unsigned char cnt = 0;
+    unsigned char box_cnt[3] = {0};
+    unsigned long long hist = 0;
+    for (int c = 0; c < 9; c++) {
+        if ( v[r*9+c] ) {
+            cnt++;
+            box_cnt[c/3]++;
+            hist += 1ULL << (4*(cross_cnt[c]-1));
+        }
+    }
+    if ( box_cnt[0] > box_cnt[1] ) std::swap(box_cnt[0], box_cnt[1]);
+    if ( box_cnt[1] > box_cnt[2] ) std::swap(box_cnt[1], box_cnt[2]);
+    if ( box_cnt[0] > box_cnt[1] ) std::swap(box_cnt[0], box_cnt[1]);
+    return ((unsigned long long)cnt << 60) | ((unsigned long long)box_cnt[0] << 56)
+         | ((unsigned long long)box_cnt[1] << 52) | ((unsigned long long)box_cnt[2] << 48) | hist;
+}
+
+// order the rows of v by their keys: first the bands, then the rows within each band.
+// the key of the orientation (the sorted band keys) is returned in okey.
+// The runs of equal keys are added to runs.
+inline void order_lines(const unsigned char v[81], const unsigned char cross_cnt[9], LineOrder &o,
+                        unsigned long long okey[9], OrderRun runs[], int &nruns) {
+    unsigned long long key[9];
+    for (int r = 0; r < 9; r++) {
+        key[r] = line_key(v, r, cross_cnt);
+    }
+    unsigned long long bkey[3][3];
+    for (int b = 0; b < 3; b++) {
+        unsigned char *row = o.row[b];
+        row[0] = 3*b; row[1] = 3*b+1; row[2] = 3*b+2;
+        std::stable_sort(row, row+3, [&](unsigned char x, unsigned char y) { return key[x] < key[y]; });
+        for (int k = 0; k < 3; k++) {
+            bkey[b][k] = key[row[k]];
+            row[k] -= 3*b;
+        }
+    }
+    o.band[0] = 0; o.band[1] = 1; o.band[2] = 2;
+    auto band_less = [&](unsigned char x, unsigned char y) {
+        return std::lexicographical_compare(bkey[x], bkey[x]+3, bkey[y], bkey[y]+3);
+    };
+    std::stable_sort(o.band, o.band+3, band_less);
+    for (int b = 0; b < 3; b++) {
+        for (int k = 0; k < 3; k++) {
+            okey[b*3+k] = bkey[o.band[b]][k];
+        }
+    }
+    // runs of equal keys
+    for (int b = 0; b < 3; ) {
+        int e = b+1;
+        while ( e < 3 && !band_less(o.band[b], o.band[e]) ) e++;
+        if ( e-b > 1 ) runs[nruns++] = { &o.band[b], (unsigned char)(e-b) };
+        b = e;
+    }
+    for (int b = 0; b < 3; b++) {
+        for (int k = 0; k < 3; ) {
+            int e = k+1;
+            while ( e < 3 && bkey[b][e] == bkey[b][k] ) e++;
+            if ( e-k > 1 ) runs[nruns++] = { &o.row[b][k], (unsigned char)(e-k) };
+            k = e;
+        }
+    }
+}
+
+// the canonical form of a puzzle (81 characters '0'-'9') and the transformation to get it.
+void canonicalize(const signed char *puzzle, signed char canon[81], CanonTransform &t) {
+    unsigned char v[2][81];          // the puzzle and the transposed puzzle
+    for (int i = 0; i < 81; i++) {
+        v[0][i] = cell_digit(puzzle[i]);
+        v[1][(i%9)*9 + i/9] = v[0][i];
+    }
+    unsigned char cnt[2][9] = {{0}};   // row counts, column counts
+    for (int i = 0; i < 81; i++) {
+        if ( v[0][i] ) {
+            cnt[0][i/9]++;
+            cnt[1][i%9]++;
+        }
+    }
+
+    // the order of rows and of columns, for both orientations
+    LineOrder rows[2], cols[2];
+    unsigned long long rkey[2][9], ckey[2][9];
+    OrderRun runs[2][24];
+    int nruns[2] = {0, 0};
+    for (int o = 0; o < 2; o++) {
+        order_lines(v[o],   cnt[1-o], rows[o], rkey[o], runs[o], nruns[o]);
+        order_lines(v[1-o], cnt[o],   cols[o], ckey[o], runs[o], nruns[o]);
+    }
+    // pick the orientation by the keys
+    int ofirst = 0, olast = 1;
+    int cmp = memcmp(rkey[0], rkey[1], sizeof(rkey[0]));
+    if ( cmp == 0 ) {
+        cmp = memcmp(ckey[0], ckey[1], sizeof(ckey[0]));
+    }
+    if ( cmp < 0 ) {
+        olast = 0;
+    } else if ( cmp > 0 ) {
+        ofirst = 1;
+    }
+
+    bool first = true;
+    for (int o = ofirst; o <= olast; o++) {
+        // enumerate the orderings of the runs, unless there are too many
+        unsigned long long orderings = 1;
+        for (int k = 0; k < nruns[o]; k++) {
+            orderings *= runs[o][k].len == 2 ? 2 : 6;
+        }
+        int nr = orderings > CANON_MAX_ORDERINGS ? 0 : nruns[o];
+        for (;;) {
+            // the candidate
+            signed char cand[81];
+            unsigned char cell[81];
+            unsigned char digit[10] = {0};
+            unsigned char next_digit = 1;
+            for (int i = 0; i < 81; i++) {
+                int R = i/9, C = i%9;
+                int r = 3*rows[o].band[R/3] + rows[o].row[rows[o].band[R/3]][R%3];
+                int c = 3*cols[o].band[C/3] + cols[o].row[cols[o].band[C/3]][C%3];
+                cell[i] = o ? c*9+r : r*9+c;
+                unsigned char d = v[0][cell[i]];
+                if ( d && digit[d] == 0 ) {
+                    digit[d] = next_digit++;
+                }
+                cand[i] = '0' + digit[d];
+            }
+            if ( first || memcmp(cand, canon, 81) < 0 ) {
+                first = false;
+                memcpy(canon, cand, 81);
+                memcpy(t.cell, cell, 81);
+                memcpy(t.digit, digit, 10);
+            }
+            // next ordering: odometer over the runs
+            int k = 0;
+            while ( k < nr && !std::next_permutation(runs[o][k].first, runs[o][k].first + runs[o][k].len) ) {
+                k++;
+            }
+            if ( k == nr ) {
+                break;
+            }
+        }
+    }
+    // number the digits that are not in the puzzle
+    unsigned char next_digit = 1;
+    for (int d = 1; d <= 9; d++) {
+        if ( t.digit[d] ) {
+            next_digit++;
+        }
+    }
+    for (int d = 1; d <= 9; d++) {
+        if ( t.digit[d] == 0 ) {
+            t.digit[d] = next_digit++;
+        }
+    }
+}
+
+// SolutionCache
+// a bounded hash table, 4-way set associative, with a lock per shard.
+// An entry holds the canonical puzzle and its canonical solution, packed (see pack_grid).
+//
+#define CACHE_SHARDS 64
+#define CACHE_WAYS   4
+
+class __attribute__ ((aligned(64))) CacheEntry
+{
+public:
+    signed char key[41];      // the canonical puzzle
+    signed char solution[41]; // the canonical solution
+    unsigned char flags;      // CACHE_* below, 0 for an empty entry
+};
+
+#define CACHE_VALID       1
+#define CACHE_NO_SOLUTION 2
+#define CACHE_NON_UNIQUE  4
+#define CACHE_CHECKED     8   // uniqueness was checked
+
+class __attribute__ ((aligned(64))) CacheShard
+{
+public:
+    std::mutex mtx;
+    std::vector<CacheEntry> entries;
+    std::vector<unsigned char> victim;   // per set, the way to replace next
+};
+
+class SolutionCache
+{
+    CacheShard shards[CACHE_SHARDS];
+    size_t sets;      // per shard
+
+    static unsigned long long hash(const signed char key[41]) {
+        unsigned long long h = 0xcbf29ce484222325ULL;
+        for (int k = 0; k < 41; k++) {
+            h = (h ^ (unsigned char)key[k]) * 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+public:
+    SolutionCache(size_t size) {
+        sets = size/(CACHE_SHARDS*CACHE_WAYS);
+        if ( sets == 0 ) {
+            sets = 1;
+        }
+        for (int s = 0; s < CACHE_SHARDS; s++) {
+            shards[s].entries.resize(sets*CACHE_WAYS);
+            shards[s].victim.resize(sets);
+        }
+    }
+
+    // returns the flags, and the solution if found (0 if not found)
+    unsigned char lookup(const signed char key[41], signed char solution[41]) {
+        unsigned long long h = hash(key);
+        CacheShard &shard = shards[h % CACHE_SHARDS];
+        CacheEntry *set = &shard.entries[(h / CACHE_SHARDS) % sets * CACHE_WAYS];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        for (int w = 0; w < CACHE_WAYS; w++) {
+            if ( set[w].flags && memcmp(set[w].key, key, 41) == 0 ) {
+                memcpy(solution, set[w].solution, 41);
+                return set[w].flags;
+            }
+        }
+        return 0;
+    }
+
+    void insert(const signed char key[41], const signed char solution[41], unsigned char flags) {
+        unsigned long long h = hash(key);
+        CacheShard &shard = shards[h % CACHE_SHARDS];
+        size_t si = (h / CACHE_SHARDS) % sets;
+        CacheEntry *set = &shard.entries[si * CACHE_WAYS];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        int w;
+        for (w = 0; w < CACHE_WAYS; w++) {
+            if ( set[w].flags == 0 || memcmp(set[w].key, key, 41) == 0 ) {
+                break;
+            }
+        }
+        if ( w == CACHE_WAYS ) {
+            w = shard.victim[si];
+            shard.victim[si] = (w+1) % CACHE_WAYS;
+        }
+        memcpy(set[w].key, key, 41);
+        memcpy(set[w].solution, solution, 41);
+        set[w].flags = flags;
+    }
+};
+
+// the cache is kept for the life of the process and shared by all batches,
+// its size is set by the first batch that uses it.
+SolutionCache *solution_cache = 0;
+std::mutex solution_cache_mtx;
+
+inline SolutionCache *get_solution_cache(size_t size) {
+    std::lock_guard<std::mutex> lock(solution_cache_mtx);
+    if ( solution_cache == 0 ) {
+        solution_cache = new SolutionCache(size);
+    }
+    return solution_cache;
+}
+
+// look up a puzzle in the cache.
+// On a hit, the solution is entered into grid and the counts are updated as solve would.
+// key and t are set for add_to_cache.
+bool solve_from_cache(SolutionCache *cache, const signed char *puzzle, signed char *grid,
+                      signed char key[41], CanonTransform &t, const schoku_opts &opts, Stats &stats, int line) {
+    signed char canon[81];
+    canonicalize(puzzle, canon, t);
+    pack_grid(canon, key);
+
+    signed char solution[41];
+    unsigned char flags = cache->lookup(key, solution);
+    if ( flags == 0 || (opts.unique_check && !(flags & CACHE_CHECKED)) ) {
+        return false;
+    }
+    stats.cache_hits++;
+    if ( flags & CACHE_NO_SOLUTION ) {
+        printf("Line %d: No solution found!\n", line);
+        stats.unsolved_count++;
+        return true;
+    }
+    unsigned char digit[10];    // the inverse of t.digit
+    for (int d = 0; d < 10; d++) {
+        digit[t.digit[d]] = d;
+    }
+    for (int k = 0; k < 81; k++) {
+        unsigned char d = (k & 1) ? solution[k>>1] & 0xf : (unsigned char)solution[k>>1] >> 4;
+        grid[t.cell[k]] = '0' + digit[d];
+    }
+    if ( opts.unique_check && (flags & CACHE_NON_UNIQUE) ) {
+        if ( opts.reportstats ) {
+            printf("Line %d: solution to puzzle is not unique\n", line);
+        }
+        stats.non_unique_count++;
+    }
+    if ( opts.reportstats ) {
+        stats.solved_count++;
+        if ( opts.verify ) {
+            stats.verified_count++;
+        }
+    }
+    return true;
+}
+
+// add the result of solve for a puzzle looked up by solve_from_cache.
+void add_to_cache(SolutionCache *cache, const signed char key[41], const CanonTransform &t,
+                  const signed char *grid, unsigned char flags) {
+    signed char canon[81];
+    for (int k = 0; k < 81; k++) {
+        canon[k] = '0' + t.digit[cell_digit(grid[t.cell[k]])];
+    }
+    signed char solution[41];
+    pack_grid(canon, solution);
+    cache->insert(key, solution, flags | CACHE_VALID);
+}
+
+// OrderedOutput
+// The output of solve_batch to a file descriptor that cannot be mapped, e.g. stdout or a pipe.
+// The threads solve chunks of OUTPUT_CHUNK puzzles into the buffers of a window of OUTPUT_WINDOW
+// chunks, and the chunks are written in the order of the input: the thread that completes
+// the next chunk to write writes it, together with all completed chunks that follow (writev).
+// The other threads go on solving meanwhile, unless the window is full.
+//
+#define OUTPUT_CHUNK  64
+#define OUTPUT_WINDOW 1024
+
+class OrderedOutput {
+    int fd;
+    std::mutex mtx;
+    std::condition_variable cv;         // a chunk was written
+    signed char *buffers[OUTPUT_WINDOW];
+    size_t bytes[OUTPUT_WINDOW];        // the size of a completed chunk, 0 while it is solved
+    size_t next = 0;                    // the next chunk to write
+    bool writing = false;               // a thread is writing
+
+    void write_chunks(struct iovec *iov, int cnt) {
+        while ( cnt ) {
+            ssize_t w = writev(fd, iov, cnt);
+            if ( w == -1 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+                exit(0);
+            }
+            while ( cnt && (size_t)w >= iov->iov_len ) {
+                w -= iov->iov_len;
+                iov++;
+                cnt--;
+            }
+            if ( cnt ) {
+                iov->iov_base = (char *)iov->iov_base + w;
+                iov->iov_len -= w;
+            }
+        }
+    }
+
+public:
+    OrderedOutput(int fd_, size_t rsize) : fd(fd_) {
+        for (int k = 0; k < OUTPUT_WINDOW; k++) {
+            buffers[k] = (signed char *)malloc(OUTPUT_CHUNK*rsize);
+            bytes[k] = 0;
+            if ( buffers[k] == 0 ) {
+                fprintf(stderr, "Error allocating the output buffers\n");
+                exit(0);
+            }
+        }
+    }
+
+    ~OrderedOutput() {
+        for (int k = 0; k < OUTPUT_WINDOW; k++) {
+            free(buffers[k]);
+        }
+    }
+
+    // start a batch, the chunks are numbered from 0
+    void start() {
+        next = 0;
+    }
+
+    // the buffer for chunk c, waits until it is in the window
+    signed char *buffer(size_t c) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return c < next + OUTPUT_WINDOW; });
+        return buffers[c % OUTPUT_WINDOW];
+    }
+
+    // chunk c is solved, size bytes of its buffer are to be written
+    void done(size_t c, size_t size) {
+        std::unique_lock<std::mutex> lock(mtx);
+        bytes[c % OUTPUT_WINDOW] = size;
+        if ( writing || c != next ) {
+            return;
+        }
+        writing = true;
+        struct iovec iov[IOV_MAX < OUTPUT_WINDOW ? IOV_MAX : OUTPUT_WINDOW];
+        for (;;) {
+            int cnt = 0;
+            while ( cnt < (int)(sizeof(iov)/sizeof(iov[0])) && bytes[(next+cnt) % OUTPUT_WINDOW] ) {
+                iov[cnt].iov_base = buffers[(next+cnt) % OUTPUT_WINDOW];
+                iov[cnt].iov_len = bytes[(next+cnt) % OUTPUT_WINDOW];
+                cnt++;
+            }
+            if ( cnt == 0 ) {
+                break;
+            }
+            lock.unlock();
+            write_chunks(iov, cnt);
+            lock.lock();
+            for (int k = 0; k < cnt; k++) {
+                bytes[(next+k) % OUTPUT_WINDOW] = 0;
+            }
+            next += cnt;
+            cv.notify_all();
+        }
+        writing = false;
+    }
+};
+
+// NUMA mode (schoku_opts numa)
+// The puzzles of a batch are split into a contiguous range per NUMA node, in proportion to
+// the threads of the node.  The threads of a node are bound to its CPUs, copy the puzzles
+// of their range to memory allocated on the node (first touch), and solve them in chunks
+// of NUMA_CHUNK puzzles; the output records of a range are written by the same threads.
+// A thread that runs out of the chunks of its node takes the remaining chunks of other nodes.
+// The nodes and their CPUs are read from /sys/devices/system/node, there is no NUMA mode
+// with fewer than 2 nodes.
+//
+#define NUMA_CHUNK 64
+
+struct NumaNode {
+    int node;
+    cpu_set_t cpus;                     // the CPUs of the node that this process may use
+    int ncpus;
+};
+
+// the NUMA nodes with CPUs that this process may use
+const std::vector<NumaNode> &numa_nodes() {
+    static std::vector<NumaNode> nodes;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        cpu_set_t allowed;
+        if ( sched_getaffinity(0, sizeof(allowed), &allowed) == -1 ) {
+            return;
+        }
+        DIR *dir = opendir("/sys/devices/system/node");
+        if ( dir == 0 ) {
+            return;
+        }
+        struct dirent *entry;
+        while ( (entry = readdir(dir)) != 0 ) {
+            int node;
+            if ( sscanf(entry->d_name, "node%d", &node) != 1 ) {
+                continue;
+            }
+            char path[300];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+            FILE *f = fopen(path, "r");
+            if ( f == 0 ) {
+                continue;
+            }
+            // e.g. 0-15,32-47
+            NumaNode n;
+            n.node = node;
+            n.ncpus = 0;
+            CPU_ZERO(&n.cpus);
+            int first, last;
+            while ( fscanf(f, "%d", &first) == 1 ) {
+                last = first;
+                int c = fgetc(f);
+                if ( c == '-' ) {
+                    if ( fscanf(f, "%d", &last) != 1 ) {
+                        break;
+                    }
+                    c = fgetc(f);
+                }
+                for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                    if ( CPU_ISSET(cpu, &allowed) ) {
+                        CPU_SET(cpu, &n.cpus);
+                        n.ncpus++;
+                    }
+                }
+                if ( c != ',' ) {
+                    break;
+                }
+            }
+            fclose(f);
+            if ( n.ncpus ) {
+                nodes.push_back(n);
+            }
+        }
+        closedir(dir);
+        std::sort(nodes.begin(), nodes.end(), [](const NumaNode &a, const NumaNode &b) { return a.node < b.node; });
+    });
+    return nodes;
+}
+
+// the NUMA mode is used only on a machine with more than one node, and not in debug mode
+bool numa_mode(const schoku_opts &opts) {
+    return opts.numa && !opts.debug && numa_nodes().size() > 1;
+}
+
+// NumaGroup
+// the threads of a node and their range of puzzles.
+//
+struct NumaGroup {
+    const NumaNode *node;
+    int first_thread;                   // the threads first_thread - first_thread+nthreads-1
+    int nthreads;
+    size_t first;                       // the puzzles first - end-1
+    size_t end;
+    signed char *in;                    // the local copy of the puzzles, at a stride of 82
+    std::atomic<size_t> next;           // the next chunk to solve
+    size_t nchunks;
+};
+
+class NumaPartition {
+public:
+    std::vector<NumaGroup> groups;
+
+    // split the puzzles first - n-1 for the threads of a team of nthreads threads
+    NumaPartition(const std::vector<NumaNode> &nodes, int nthreads, size_t first, size_t n) : groups(std::min((size_t)nthreads, nodes.size())) {
+        int ngroups = groups.size();
+        int ncpus = 0;
+        for (int g = 0; g < ngroups; g++) {
+            ncpus += nodes[g].ncpus;
+        }
+        // the threads and the puzzles in proportion to the CPUs, at least one thread per node
+        int threads = 0;
+        int cpus = 0;
+        for (int g = 0; g < ngroups; g++) {
+            NumaGroup &group = groups[g];
+            cpus += nodes[g].ncpus;
+            int end_thread = g == ngroups-1 ? nthreads : std::max(threads+1, (int)((long)nthreads*cpus/ncpus));
+            end_thread = std::min(end_thread, nthreads-(ngroups-1-g));
+            group.node = &nodes[g];
+            group.first_thread = threads;
+            group.nthreads = end_thread - threads;
+            threads = end_thread;
+        }
+        for (int g = 0; g < ngroups; g++) {
+            NumaGroup &group = groups[g];
+            group.first = g ? groups[g-1].end : first;
+            group.end = first + (n-first)*(group.first_thread+group.nthreads)/nthreads;
+            group.nchunks = (group.end - group.first + NUMA_CHUNK-1)/NUMA_CHUNK;
+            group.next = 0;
+            // allocated here, placed by the first touch of the threads of the group
+            group.in = 0;
+            if ( group.end > group.first ) {
+                group.in = (signed char *)mmap((void*)0, (group.end-group.first)*82, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+                if ( group.in == MAP_FAILED ) {
+                    fprintf(stderr, "Error allocating the puzzles of NUMA node %d: %s\n", group.node->node, strerror(errno));
+                    exit(0);
+                }
+            }
+        }
+    }
+
+    ~NumaPartition() {
+        for (NumaGroup &group : groups) {
+            if ( group.in ) {
+                munmap(group.in, (group.end-group.first)*82);
+            }
+        }
+    }
+
+    NumaGroup &group_of(int thread) {
+        for (NumaGroup &group : groups) {
+            if ( thread < group.first_thread + group.nthreads ) {
+                return group;
+            }
+        }
+        return groups.back();
+    }
+};
+
+// Work stealing (SCHOKU_SCHEDULE_STEAL)
+// Each thread starts with a contiguous range of the puzzles, split at multiples of the puzzles
+// per page of output records (the quantum), so no two threads write to the same output page.
+// A thread takes STEAL_GRAIN puzzles at a time from the front of its range.  A thread that
+// runs out steals the back half of the largest remaining range of the others, split at a
+// quantum if that range spans more than 2 of them, and continues with that.
+// So the chunks are large with easy puzzles and get smaller only where the work is unbalanced.
+// A range is one 64-bit word of its first (high half) and its end puzzle, updated by
+// compare and swap, this limits a batch to 2^32 puzzles (as the order of the schedules).
+//
+#define STEAL_GRAIN 16
+
+class StealScheduler {
+    struct alignas(64) Range {
+        std::atomic<unsigned long long> range;
+    };
+    std::vector<Range> ranges;
+    size_t quantum;
+
+    static unsigned long long pack(size_t first, size_t end) {
+        return (unsigned long long)first << 32 | end;
+    }
+    static size_t first_of(unsigned long long r) {
+        return r >> 32;
+    }
+    static size_t end_of(unsigned long long r) {
+        return r & 0xffffffffULL;
+    }
+
+public:
+    // split the puzzles first - n-1 for nthreads threads, output records of rsize bytes
+    StealScheduler(int nthreads, size_t first, size_t n, size_t rsize) : ranges(nthreads) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t a = page, b = rsize;
+        while ( b ) {
+            size_t r = a % b;
+            a = b;
+            b = r;
+        }
+        quantum = page/a;
+        size_t begin = first;
+        for (int t = 0; t < nthreads; t++) {
+            size_t end = t == nthreads-1 ? n : (first + (n-first)*(t+1)/nthreads)/quantum*quantum;
+            end = std::max(end, begin);
+            ranges[t].range = pack(begin, end);
+            begin = end;
+        }
+    }
+
+    // the next puzzles first - end-1 of thread t, false if all are taken
+    bool next(int t, size_t &first, size_t &end, Stats &stats) {
+        std::atomic<unsigned long long> &own = ranges[t].range;
+        for (;;) {
+            unsigned long long r = own.load(std::memory_order_acquire);
+            while ( first_of(r) < end_of(r) ) {
+                size_t take = std::min(first_of(r)+STEAL_GRAIN, end_of(r));
+                if ( own.compare_exchange_weak(r, pack(take, end_of(r)), std::memory_order_acq_rel) ) {
+                    first = first_of(r);
+                    end = take;
+                    return true;
+                }
+            }
+            // steal from the largest remaining range
+            int victim = -1;
+            size_t largest = 0;
+            for (int v = 0; v < (int)ranges.size(); v++) {
+                unsigned long long rv = ranges[v].range.load(std::memory_order_relaxed);
+                if ( end_of(rv) - first_of(rv) > largest && first_of(rv) < end_of(rv) ) {
+                    largest = end_of(rv) - first_of(rv);
+                    victim = v;
+                }
+            }
+            if ( victim < 0 ) {
+                return false;
+            }
+            unsigned long long rv = ranges[victim].range.load(std::memory_order_acquire);
+            size_t vfirst = first_of(rv);
+            size_t vend = end_of(rv);
+            if ( vfirst >= vend ) {
+                continue;
+            }
+            size_t split;
+            if ( vend - vfirst <= STEAL_GRAIN ) {
+                split = vfirst;
+            } else if ( vend - vfirst > 2*quantum ) {
+                split = (vfirst + (vend-vfirst)/2 + quantum-1)/quantum*quantum;
+            } else {
+                split = vfirst + (vend-vfirst)/2;
+            }
+            if ( ranges[victim].range.compare_exchange_strong(rv, pack(vfirst, split), std::memory_order_acq_rel) ) {
+                // only this thread changes its empty range
+                own.store(pack(split, vend), std::memory_order_release);
+                stats.steals++;
+            }
+        }
+    }
+};
+
+// the puzzles per combination of strategies to sample with SCHOKU_STRATEGY_AUTO
+#define AUTO_SAMPLE 1024
+// the puzzles per chunk of the interleaved solving
+#define INTERLEAVE_CHUNK 64
+
+// solve n puzzles from 'in' (stride 82) to 'out' (stride schoku_record_size(opts.output_format)).
+// line is the line number of the first puzzle (for messages).
+// If latency is not 0, the solving time of each puzzle is added to it.
+// If index is not 0, puzzle k is at in[index[k]] instead of in[k*82] (see index_puzzles).
+// If sink is not 0, the solutions are written to it in the order of the input (out is not used).
+// With opts.numa, the puzzles are split by NUMA node (see NumaPartition), not with sink or opts.debug.
+//
+void solve_batch(const signed char *in, size_t n, signed char *out, const schoku_opts &opts, Stats &stats, size_t line,
+                 Latency *latency = 0, const size_t *index = 0, OrderedOutput *sink = 0) {
+
+    size_t rsize = schoku_record_size(opts.output_format);
+    int nthreads = opts.numthreads ? opts.numthreads : omp_get_max_threads();
+    bool use_avx512 = avx512_support && !opts.no_avx512;
+    bool verbose = opts.reportstats !=0 || opts.debug != 0;
+
+    // the schedule of the puzzles to the threads
+    std::vector<unsigned int> order;
+    switch ( opts.schedule ) {
+    case SCHOKU_SCHEDULE_GUIDED:
+        omp_set_schedule(omp_sched_guided, 16);
+        break;
+    case SCHOKU_SCHEDULE_HARDEST_FIRST:
+        order = hardest_first_order(in, n, index);
+        omp_set_schedule(omp_sched_dynamic, 64);
+        break;
+    case SCHOKU_SCHEDULE_STEAL:
+        // after the sample of SCHOKU_STRATEGY_AUTO (see below)
+        omp_set_schedule(omp_sched_dynamic, 64);
+        break;
+    default:
+        omp_set_schedule(omp_sched_dynamic, 64);
+        break;
+    }
+    // NUMA mode, not with the ordered output that takes the chunks in order
+    bool numa = numa_mode(opts) && !sink;
+    NumaPartition *partition = 0;
+    const unsigned int *porder = order.empty() || sink || numa ? 0 : order.data();
+    size_t nchunks = (n + OUTPUT_CHUNK-1)/OUTPUT_CHUNK;
+    if ( sink ) {
+        sink->start();
+    }
+
+    // the strategies
+    // With SCHOKU_STRATEGY_AUTO, the first 8*AUTO_SAMPLE puzzles (in the order of the schedule)
+    // are solved by the 8 combinations of the strategies in turn, and the combination with
+    // the least total solving time solves the rest.  Smaller batches use the default.
+    int strategies = (opts.strategies & SCHOKU_STRATEGY_SELECTED) ? opts.strategies & STRATEGY_MASK : default_strategies;
+    size_t nsample = 0;
+    if ( (opts.strategies & SCHOKU_STRATEGY_AUTO) && n >= 2*STRATEGY_COMBINATIONS*AUTO_SAMPLE ) {
+        nsample = STRATEGY_COMBINATIONS*AUTO_SAMPLE;
+    }
+    long long sample_ns[STRATEGY_COMBINATIONS] = {0};
+
+    // parallel search, not with the packed or the ordered output which need the solution when solve returns,
+    // and only by the cell-major engine
+    BranchPool *pool = 0;
+    if ( opts.parallel_search && opts.output_format != SCHOKU_OUTPUT_PACKED && !sink && !opts.debug
+      && opts.engine == SCHOKU_ENGINE_CELLS ) {
+        pool = new BranchPool(0);
+    }
+
+    // interleaved solving, by the digit-major engine, not with the ordered output or NUMA mode
+    bool interleave = opts.interleave > 1 && opts.engine == SCHOKU_ENGINE_DIGITS && !sink && !numa && !opts.debug;
+
+    // work stealing, in place of the OMP loop over the puzzles
+    bool steal = opts.schedule == SCHOKU_SCHEDULE_STEAL && !sink && !numa && !interleave && !opts.debug && n < (1ULL << 32);
+    StealScheduler *scheduler = 0;
+
+    // the solution cache, not with parallel search where solve returns before the puzzle is done
+    // or with interleaved solving
+    SolutionCache *cache = 0;
+    if ( opts.cache_size && !pool && !opts.debug && !opts.solution_limit && !interleave ) {
+        cache = get_solution_cache(opts.cache_size);
+    }
+
+    // The OMP directives:
+    // if(!opts.debug): debug mode requires restriction of the number of threads to 1
+    // proc_bind(close): high preferance for thread/core affinity
+    // schedule(runtime): as set by omp_set_schedule above, by default dynamic,64:
+    //   64 puzzles are allocated at a time and these chunks
+    //   are assigned dynmically (to minimize random effects of difficult puzzles)
+    // nowait: each thread adds its statistics as soon as it runs out of chunks
+    // shared(...) lists the variables that are shared (as opposed to separate copies per thread)
+    // The stack is allocated for each thread once and seperately (see get_thread_stack).
+    // With parallel search, the threads that run out of puzzles search the branches
+    // offered by the others until all threads are done.
+    //
+#pragma omp parallel if(!opts.debug) num_threads(nthreads) proc_bind(close) shared(in, out, n, rsize, opts, stats, pool, porder, cache, latency, index, sink, nchunks, numa, partition, strategies, nsample, sample_ns, interleave, steal, scheduler)
+    {
+        // the statistics of this thread
+        Stats my_stats;
+        Latency *my_latency = latency ? new Latency : 0;
+
+        Solver solvers[STRATEGY_COMBINATIONS];
+        for (int s = 0; s < STRATEGY_COMBINATIONS; s++) {
+            solvers[s] = get_solver(verbose, use_avx512, s);
+        }
+
+        // set up record for puzzle, returns the grid to solve in place
+        // (in the record, or packed_grid for the packed output)
+        auto setup_record = [&](signed char *record, const signed char *puzzle, signed char *packed_grid) {
+            signed char *grid;
+            switch ( opts.output_format ) {
+            case SCHOKU_OUTPUT_SOLUTION:
+                grid = record;
+                record[81] = 10;
+                break;
+            case SCHOKU_OUTPUT_PACKED:
+                // solved on the side, packed below
+                grid = packed_grid;
+                break;
+            default:
+                // copy unsolved grid
+                grid = &record[82];
+                memcpy(record, puzzle, 81);
+                // add comma and newline in right place
+                record[81] = ',';
+                record[163] = 10;
+                break;
+            }
+            copy_puzzle(grid, puzzle);
+            return grid;
+        };
+
+        // solve puzzle k (in the order of the schedule) with the strategies s
+        // from puzzle into record, by default from 'in' into its record of out
+        auto solve_puzzle = [&](size_t k, int s, signed char *record, const signed char *puzzle) {
+            size_t j = porder ? porder[k] : k;
+            if ( puzzle == 0 ) {
+                puzzle = index ? &in[index[j]] : &in[j*82];
+            }
+            if ( record == 0 ) {
+                record = &out[j*rsize];
+            }
+            std::chrono::steady_clock::time_point puzzle_start;
+            if ( my_latency ) {
+                puzzle_start = std::chrono::steady_clock::now();
+            }
+            signed char packed_grid[81];
+            signed char *grid = setup_record(record, puzzle, packed_grid);
+            signed char key[41];
+            CanonTransform t;
+            if ( !cache || !solve_from_cache(cache, puzzle, grid, key, t, opts, my_stats, line+j) ) {
+                long unsolved = my_stats.unsolved_count;
+                long non_unique = my_stats.non_unique_count;
+                long not_verified = my_stats.not_verified_count;
+
+                // solve the grid in place
+                if ( opts.engine == SCHOKU_ENGINE_DIGITS ) {
+                    if ( verbose ) {
+                        solve_digits<true>(grid, line+j, opts, my_stats);
+                    } else {
+                        solve_digits<false>(grid, line+j, opts, my_stats);
+                    }
+                } else {
+                    GridState *stack = get_thread_stack();
+
+                    if ( stack[0].initialize(grid) ) {
+                        solvers[s](grid, stack, line+j, opts, my_stats, pool, 0);
+                    } else {
+                        conflicting_clues(line+j, opts, my_stats);
+                    }
+                    my_stats.strategy_count[s]++;
+                }
+
+                // a puzzle that failed verification is not cached
+                if ( cache && my_stats.not_verified_count == not_verified ) {
+                    add_to_cache(cache, key, t, grid,
+                                 (my_stats.unsolved_count != unsolved ? CACHE_NO_SOLUTION : 0)
+                               | (my_stats.non_unique_count != non_unique ? CACHE_NON_UNIQUE : 0)
+                               | (opts.unique_check ? CACHE_CHECKED : 0));
+                }
+            }
+            if ( opts.output_format == SCHOKU_OUTPUT_PACKED ) {
+                pack_grid(grid, record);
+            }
+            if ( my_latency ) {
+                my_latency->record(line+j, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - puzzle_start).count());
+            }
+        };
+
+        // solve chunk c (OUTPUT_CHUNK puzzles) of the ordered output
+        auto solve_chunk = [&](size_t c, int s) {
+            signed char *buffer = sink->buffer(c);
+            size_t first = c*OUTPUT_CHUNK;
+            size_t end = first+OUTPUT_CHUNK < n ? first+OUTPUT_CHUNK : n;
+            for (size_t k = first; k < end; k++) {
+                solve_puzzle(k, s, &buffer[(k-first)*rsize], 0);
+            }
+            sink->done(c, (end-first)*rsize);
+        };
+
+        if ( pool ) {
+#pragma omp single
+            pool->busy = omp_get_num_threads();
+        }
+
+        if ( nsample ) {
+            long long my_sample_ns[STRATEGY_COMBINATIONS] = {0};
+            if ( sink ) {
+                // by chunks
+#pragma omp for schedule(dynamic,1) nowait
+                for (size_t c = 0; c < nsample/OUTPUT_CHUNK; c++) {
+                    auto start = std::chrono::steady_clock::now();
+                    solve_chunk(c, c%STRATEGY_COMBINATIONS);
+                    my_sample_ns[c%STRATEGY_COMBINATIONS] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                }
+            } else {
+#pragma omp for schedule(runtime) nowait
+                for (size_t k = 0; k < nsample; k++) {
+                    auto start = std::chrono::steady_clock::now();
+                    solve_puzzle(k, k%STRATEGY_COMBINATIONS, 0, 0);
+                    my_sample_ns[k%STRATEGY_COMBINATIONS] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                }
+            }
+#pragma omp critical
+            for (int s = 0; s < STRATEGY_COMBINATIONS; s++) {
+                sample_ns[s] += my_sample_ns[s];
+            }
+#pragma omp barrier
+#pragma omp single
+            for (int s = 0; s < STRATEGY_COMBINATIONS; s++) {
+                if ( sample_ns[s] < sample_ns[strategies] ) {
+                    strategies = s;
+                }
+            }
+        }
+
+        if ( sink ) {
+            // the chunks are taken in order, so the next chunk to write is always being solved
+#pragma omp for schedule(dynamic,1) nowait
+            for (size_t c = nsample/OUTPUT_CHUNK; c < nchunks; c++) {
+                solve_chunk(c, strategies);
+            }
+        } else if ( numa ) {
+#pragma omp single
+            partition = new NumaPartition(numa_nodes(), omp_get_num_threads(), nsample, n);
+
+            // bind this thread to its node
+            NumaGroup &group = partition->group_of(omp_get_thread_num());
+            cpu_set_t saved_cpus;
+            bool bound = pthread_getaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus) == 0
+                      && pthread_setaffinity_np(pthread_self(), sizeof(group.node->cpus), &group.node->cpus) == 0;
+            set_thread_stack_node(group.node->node);
+
+            // copy this thread's share of the puzzles of its node
+            int r = omp_get_thread_num() - group.first_thread;
+            size_t size = group.end - group.first;
+            for (size_t k = group.first + size*r/group.nthreads; k < group.first + size*(r+1)/group.nthreads; k++) {
+                signed char *local = &group.in[(k-group.first)*82];
+                memcpy(local, index ? &in[index[k]] : &in[k*82], 81);
+                local[81] = 10;
+            }
+#pragma omp barrier
+
+            // the chunks of this node, then the remaining chunks of the others
+            int ngroups = partition->groups.size();
+            int g0 = &group - partition->groups.data();
+            for (int g = 0; g < ngroups; g++) {
+                NumaGroup &from = partition->groups[(g0+g) % ngroups];
+                size_t c;
+                while ( (c = from.next++) < from.nchunks ) {
+                    size_t first = from.first + c*NUMA_CHUNK;
+                    size_t end = std::min(first+NUMA_CHUNK, from.end);
+                    for (size_t k = first; k < end; k++) {
+                        solve_puzzle(k, strategies, 0, &from.in[(k-from.first)*82]);
+                    }
+                }
+            }
+            if ( bound ) {
+                pthread_setaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus);
+            }
+        } else if ( interleave ) {
+            // by chunks of INTERLEAVE_CHUNK puzzles, each solved interleaved
+#pragma omp for schedule(dynamic,1) nowait
+            for (size_t c = 0; c < (n-nsample+INTERLEAVE_CHUNK-1)/INTERLEAVE_CHUNK; c++) {
+                size_t first = nsample + c*INTERLEAVE_CHUNK;
+                size_t end = std::min(first+INTERLEAVE_CHUNK, n);
+                signed char *grids[INTERLEAVE_CHUNK];
+                size_t lines[INTERLEAVE_CHUNK];
+                signed char packed_grids[INTERLEAVE_CHUNK][81];
+                for (size_t k = first; k < end; k++) {
+                    size_t j = porder ? porder[k] : k;
+                    grids[k-first] = setup_record(&out[j*rsize], index ? &in[index[j]] : &in[j*82], packed_grids[k-first]);
+                    lines[k-first] = line+j;
+                }
+                if ( verbose ) {
+                    solve_interleaved<true>(end-first, grids, lines, opts.interleave, opts, my_stats, my_latency);
+                } else {
+                    solve_interleaved<false>(end-first, grids, lines, opts.interleave, opts, my_stats, my_latency);
+                }
+                if ( opts.output_format == SCHOKU_OUTPUT_PACKED ) {
+                    for (size_t k = first; k < end; k++) {
+                        pack_grid(grids[k-first], &out[(porder ? porder[k] : k)*rsize]);
+                    }
+                }
+            }
+        } else if ( steal ) {
+#pragma omp single
+            scheduler = new StealScheduler(omp_get_num_threads(), nsample, n, rsize);
+
+            size_t first, end;
+            while ( scheduler->next(omp_get_thread_num(), first, end, my_stats) ) {
+                for (size_t k = first; k < end; k++) {
+                    solve_puzzle(k, strategies, 0, 0);
+                }
+            }
+        } else {
+#pragma omp for schedule(runtime) nowait
+            for (size_t k = nsample; k < n; k++) {
+                solve_puzzle(k, strategies, 0, 0);
+            }
+        }
+
+        if ( pool ) {
+            Branch branch;
+            while ( pool->take(branch) ) {
+                SearchState *search = branch.search;
+                if ( search->stop ) {
+                    release_search(search, my_stats);
+                    continue;
+                }
+                GridState *stack = get_thread_stack();
+                memcpy(&stack[0], &branch.state, sizeof(GridState));
+                solvers[strategies](search->grid, stack, search->line, opts, my_stats, pool, search);
+            }
+        }
+
+#pragma omp critical
+        {
+            stats.add(my_stats);
+            if ( my_latency ) {
+                latency->add(*my_latency);
+            }
+        }
+        delete my_latency;
+    }
+    delete pool;
+    delete partition;
+    delete scheduler;
+}
+
+// The library interface, see schoku.h
+//
+extern "C" int schoku_init(void) {
+    // sort out the CPU settings
+#ifdef SCHOKU_SIMD_AVX2
+    if ( !__builtin_cpu_supports("avx2") ) {
+        return SCHOKU_NO_AVX2;
+    }
+    // lacking BMI support? unlikely!
+    if ( !__builtin_cpu_supports("bmi") ) {
+        return SCHOKU_NO_BMI;
+    }
+
+    bmi2_support = __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver2");
+    avx512_support = __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+#elif defined(SCHOKU_SIMD_SSE41)
+    if ( !__builtin_cpu_supports("sse4.1") || !__builtin_cpu_supports("popcnt") ) {
+        return SCHOKU_NO_AVX2;
+    }
+#endif
+    return 0;
+}
+
+extern "C" size_t schoku_solve_batch(const char *in, size_t n, char *out, const schoku_opts *opts, schoku_stats *stats) {
+    const schoku_opts default_opts {};
+    Stats batch_stats;
+
+    solve_batch((const signed char *)in, n, (signed char *)out, opts ? *opts : default_opts, batch_stats, 1);
+
+    if ( stats ) {
+        batch_stats.copy_to(stats);
+    }
+    return n - batch_stats.unsolved_count;
+}
+
+#ifndef SCHOKU_LIBRARY
+
+// index_puzzles
+// find the puzzles in the input: a line with at least 81 characters is a puzzle, given by
+// its first 81 characters, any characters after these (such as a carriage return or further
+// columns) are ignored.  Any character other than a digit is an empty cell (see copy_puzzle).
+// Empty lines and lines starting with '#' are skipped, shorter lines are skipped and counted.
+// The lines are found by comparing 32 characters at a time with the newline.
+// Returns the offsets of the puzzles, or no offsets if the puzzles are at a stride of 82
+// (every line is a puzzle of 81 characters), which solve_batch handles without an index.
+//
+std::vector<size_t> index_puzzles(const signed char *buf, size_t size, size_t &npuzzles, size_t &skipped) {
+    std::vector<size_t> index;
+    index.reserve(size/82+1);
+    bool strided = true;
+    size_t start = 0;
+
+    auto add_line = [&](size_t end) {
+        size_t len = end - start;
+        if ( len == 0 || buf[start] == '#' || (len == 1 && buf[start] == 13) ) {
+            // empty or a comment
+        } else if ( len < 81 ) {
+            skipped++;
+        } else {
+            strided = strided && start == index.size()*82;
+            index.push_back(start);
+        }
+        start = end+1;
+    };
+
+    const __m256i newline = _mm256_set1_epi8(10);
+    size_t k = 0;
+    for (; k+32 <= size; k += 32) {
+        unsigned int nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i_u*) &buf[k]), newline));
+        while ( nl ) {
+            add_line(k + _tzcnt_u32(nl));
+            nl = _blsr_u32(nl);
+        }
+    }
+    for (; k < size; k++) {
+        if ( buf[k] == 10 ) {
+            add_line(k);
+        }
+    }
+    if ( start < size ) {
+        // the last line has no newline
+        add_line(size);
+    }
+
+    npuzzles = index.size();
+    if ( strided ) {
+        index.clear();
+        index.shrink_to_fit();
+    }
+    return index;
+}
+
+// Streaming mode (-s, or when the input is not a regular file)
+// The input is read in chunks of STREAM_CHUNK*82 bytes, the puzzles of the complete lines
+// of a chunk are found by index_puzzles (as for a file) and copied into a ring of STREAM_RING
+// buffers, a partial last line is carried over to the next chunk.
+// A reader thread fills the buffers, the calling thread solves them (solve_batch) and
+// a writer thread writes the solutions in the order of the input.
+// The memory used is bounded by the ring, independent of the size of the input,
+// and the input and output can be pipes.
+//
+#define STREAM_CHUNK 16384
+#define STREAM_RING  4
+
+struct StreamBuffer {
+    signed char *in;    // STREAM_CHUNK puzzles at a stride of 82
+    signed char *out;   // STREAM_CHUNK solutions (records of up to 164 bytes)
+    size_t n;           // number of puzzles read
+    size_t nout;        // number of solutions to write
+    enum { Empty, Filled, Solved } state;
+};
+
+// read until size bytes are read or the end of the input is reached
+size_t read_fully(int fd, signed char *buf, size_t size) {
+    size_t got = 0;
+    while ( got < size ) {
+        ssize_t r = read(fd, buf+got, size-got);
+        if ( r == 0 ) {
+            break;
+        }
+        if ( r == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            fprintf(stderr, "Error reading input: %s\n", strerror(errno));
+            exit(0);
+        }
+        got += r;
+    }
+    return got;
+}
+
+void write_fully(int fd, const signed char *buf, size_t size) {
+    while ( size ) {
+        ssize_t w = write(fd, buf, size);
+        if ( w == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            fprintf(stderr, "Error writing output: %s\n", strerror(errno));
+            exit(0);
+        }
+        buf += w;
+        size -= w;
+    }
+}
+
+// solve all puzzles from fdin to fdout.
+// with line_to_solve, only this line is solved and output.
+// returns the number of puzzles read.
+//
+size_t solve_stream(int fdin, int fdout, const schoku_opts &opts, Stats &stats, int line_to_solve) {
+
+    StreamBuffer ring[STREAM_RING];
+    for (int k = 0; k < STREAM_RING; k++) {
+        ring[k].in  = (signed char *)malloc(STREAM_CHUNK*82);
+        ring[k].out = (signed char *)malloc(STREAM_CHUNK*164);
+        ring[k].state = StreamBuffer::Empty;
+        if ( ring[k].in == 0 || ring[k].out == 0 ) {
+            fprintf(stderr, "Error allocating the stream buffers\n");
+            exit(0);
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t nchunks = ~0ULL;     // the number of chunks, known once the reader is done
+    bool done = false;          // no more input needed (line_to_solve)
+    size_t npuzzles = 0;
+    size_t skipped = 0;
+
+    std::thread reader([&] {
+        signed char *raw = (signed char *)malloc(STREAM_CHUNK*82);
+        if ( raw == 0 ) {
+            fprintf(stderr, "Error allocating the stream buffers\n");
+            exit(0);
+        }
+        size_t carry = 0;           // the bytes of a partial line at the start of raw
+        bool overlong = false;      // the rest of a line longer than a chunk is ignored
+        size_t k = 0;
+        for (;;) {
+            StreamBuffer &b = ring[k%STREAM_RING];
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return b.state == StreamBuffer::Empty || done; });
+                if ( done ) {
+                    break;
+                }
+            }
+            size_t got = carry + read_fully(fdin, raw+carry, STREAM_CHUNK*82-carry);
+            bool eof = got < STREAM_CHUNK*82;
+            size_t start = 0;
+            if ( overlong ) {
+                const signed char *nl = (const signed char *)memchr(raw, 10, got);
+                start = nl ? nl - raw + 1 : got;
+                overlong = nl == 0;
+            }
+            // the complete lines end at the last newline (or at the end of the input)
+            size_t end = got;
+            if ( !eof ) {
+                while ( end > start && raw[end-1] != 10 ) {
+                    end--;
+                }
+                if ( end == start ) {
+                    // a line longer than the chunk: its first 81 characters are the puzzle
+                    end = got;
+                    overlong = true;
+                }
+            }
+            // at most STREAM_CHUNK puzzles, each takes at least 82 bytes but the last
+            size_t n = 0;
+            std::vector<size_t> index = index_puzzles(raw+start, end-start, n, skipped);
+            for (size_t j = 0; j < n; j++) {
+                memcpy(&b.in[j*82], &raw[start + (index.empty() ? j*82 : index[j])], 81);
+                b.in[j*82+81] = 10;
+            }
+            b.n = n;
+            npuzzles += n;
+            carry = got - end;
+            memmove(raw, raw+end, carry);
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if ( b.n ) {
+                b.state = StreamBuffer::Filled;
+                k++;
+                cv.notify_all();
+            }
+            if ( eof ) {
+                break;
+            }
+        }
+        free(raw);
+        std::lock_guard<std::mutex> lock(mtx);
+        nchunks = k;
+        cv.notify_all();
+    });
+
+    std::thread writer([&] {
+        for (size_t k = 0;; k++) {
+            StreamBuffer &b = ring[k%STREAM_RING];
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return b.state == StreamBuffer::Solved || k >= nchunks; });
+                if ( b.state != StreamBuffer::Solved ) {
+                    break;
+                }
+            }
+            write_fully(fdout, b.out, b.nout*schoku_record_size(opts.output_format));
+            std::lock_guard<std::mutex> lock(mtx);
+            b.state = StreamBuffer::Empty;
+            cv.notify_all();
+        }
+    });
+
+    size_t line = 1;
+    for (size_t k = 0;; k++) {
+        StreamBuffer &b = ring[k%STREAM_RING];
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&] { return b.state == StreamBuffer::Filled || k >= nchunks; });
+            if ( b.state != StreamBuffer::Filled ) {
+                break;
+            }
+        }
+        b.nout = 0;
+        if ( line_to_solve == 0 ) {
+            solve_batch(b.in, b.n, b.out, opts, stats, line);
+            b.nout = b.n;
+        } else if ( (size_t)line_to_solve >= line && (size_t)line_to_solve < line+b.n ) {
+            solve_batch(&b.in[(line_to_solve-line)*82], 1, b.out, opts, stats, line_to_solve);
+            b.nout = 1;
+        }
+        line += b.n;
+        std::lock_guard<std::mutex> lock(mtx);
+        b.state = StreamBuffer::Solved;
+        if ( b.nout && line_to_solve ) {
+            done = true;
+        }
+        cv.notify_all();
+    }
+
+    reader.join();
+    writer.join();
+    if ( skipped ) {
+        fprintf(stderr, "found %ld puzzles, skipped %ld lines with less than 81 characters\n", npuzzles, skipped);
+    }
+    for (int k = 0; k < STREAM_RING; k++) {
+        free(ring[k].in);
+        free(ring[k].out);
+    }
+    return npuzzles;
+}
+
+// Server mode (-w)
+// A long running process that solves the puzzles of any number of requests,
+// keeping the OMP threads and their GridState stacks between the batches.
+// The requests come from stdin (the solutions go to stdout) or from the connections
+// to a Unix or TCP socket.
+// A request is a line with a puzzle of 81 characters, optionally preceded by an identifier
+// and a space.  The response is a line with the identifier (by default the line number
+// of the request on its connection), a space and the solution in the output format (-f0 or -f1).
+// The responses of a connection are in the order of its requests.
+// A reader thread per connection queues the requests, and the calling thread solves
+// all queued requests (of all connections) as one batch, i.e. the requests that arrive
+// while a batch is solved form the next batch.
+//
+#define SERVER_LINE_MAX  1024
+#define SERVER_ID_MAX    64
+#define SERVER_QUEUE_MAX 65536
+
+class Connection {
+public:
+    int fdin;
+    int fdout;
+    std::atomic<int> refs;    // the reader and the queued requests
+    bool failed = false;      // a response could not be written, e.g. the client went away
+
+    Connection(int fdin_, int fdout_) : fdin(fdin_), fdout(fdout_), refs(1) {}
+
+    void release() {
+        if ( --refs == 0 ) {
+            if ( fdin > 2 ) {
+                close(fdin);
+            }
+            if ( fdout != fdin && fdout > 2 ) {
+                close(fdout);
+            }
+            delete this;
+        }
+    }
+
+    // write a response, returns false if the connection failed
+    bool send(const char *buf, size_t size) {
+        while ( size && !failed ) {
+            ssize_t w = write(fdout, buf, size);
+            if ( w == -1 ) {
+                if ( errno == EINTR ) {
+                    continue;
+                }
+                failed = true;
+                break;
+            }
+            buf += w;
+            size -= w;
+        }
+        return !failed;
+    }
+};
+
+struct Request {
+    Connection *conn;
+    char id[SERVER_ID_MAX+1];
+    bool valid;               // a puzzle was given (and added to the puzzles of the queue)
+};
+
+class Server {
+    std::mutex mtx;
+    std::condition_variable work;      // requests were queued or a reader is done
+    std::condition_variable space;     // the queue was taken
+    std::vector<Request> requests;
+    std::vector<signed char> puzzles;  // of the valid requests, at a stride of 82
+    int readers = 1;                   // the readers and the listener
+
+    // queue the requests of a connection
+    void add(std::vector<Request> &reqs, std::vector<signed char> &puzs) {
+        std::unique_lock<std::mutex> lock(mtx);
+        space.wait(lock, [&] { return requests.size() < SERVER_QUEUE_MAX; });
+        requests.insert(requests.end(), reqs.begin(), reqs.end());
+        puzzles.insert(puzzles.end(), puzs.begin(), puzs.end());
+        work.notify_one();
+        reqs.clear();
+        puzs.clear();
+    }
+
+    // parse a request line
+    void parse(Connection *conn, const char *line, size_t len, size_t lineno,
+               std::vector<Request> &reqs, std::vector<signed char> &puzs) {
+        while ( len && (line[len-1] == '\r' || line[len-1] == ' ') ) {
+            len--;
+        }
+        if ( len == 0 ) {
+            return;
+        }
+        Request req;
+        req.conn = conn;
+        req.valid = len >= 81 && (len == 81 || line[len-82] == ' ');
+        if ( len > 81 ) {
+            size_t idlen = req.valid ? len-82 : len;
+            if ( idlen > SERVER_ID_MAX ) {
+                idlen = SERVER_ID_MAX;
+            }
+            memcpy(req.id, line, idlen);
+            req.id[idlen] = 0;
+        } else {
+            snprintf(req.id, sizeof(req.id), "%ld", lineno);
+        }
+        if ( req.valid ) {
+            puzs.insert(puzs.end(), line+len-81, line+len);
+            puzs.push_back(10);
+        }
+        conn->refs++;
+        reqs.push_back(req);
+    }
+
+public:
+    // the reader thread of a connection
+    void read_connection(Connection *conn) {
+        char buf[SERVER_LINE_MAX];
+        size_t len = 0;
+        size_t lineno = 0;
+        bool overlong = false;
+        std::vector<Request> reqs;
+        std::vector<signed char> puzs;
+        for (;;) {
+            ssize_t r = read(conn->fdin, buf+len, sizeof(buf)-len);
+            if ( r == -1 && errno == EINTR ) {
+                continue;
+            }
+            if ( r <= 0 ) {
+                if ( len && !overlong ) {
+                    parse(conn, buf, len, ++lineno, reqs, puzs);
+                }
+                break;
+            }
+            len += r;
+            size_t start = 0;
+            for (size_t k = len-r; k < len; k++) {
+                if ( buf[k] == 10 ) {
+                    if ( overlong ) {
+                        // the end of a line that is too long, answered as not valid
+                        overlong = false;
+                        Request req { conn, "", false };
+                        snprintf(req.id, sizeof(req.id), "%ld", ++lineno);
+                        conn->refs++;
+                        reqs.push_back(req);
+                    } else {
+                        parse(conn, buf+start, k-start, ++lineno, reqs, puzs);
+                    }
+                    start = k+1;
+                }
+            }
+            memmove(buf, buf+start, len-start);
+            len -= start;
+            if ( len == sizeof(buf) ) {
+                overlong = true;
+                len = 0;
+            }
+            if ( reqs.size() ) {
+                add(reqs, puzs);
+            }
+        }
+        if ( reqs.size() ) {
+            add(reqs, puzs);
+        }
+        conn->release();
+        std::lock_guard<std::mutex> lock(mtx);
+        readers--;
+        work.notify_one();
+    }
+
+    // serve stdin (to fdout)
+    void serve_stdin(int fdout) {
+        readers++;
+        std::thread reader(&Server::read_connection, this, new Connection(0, fdout));
+        reader.detach();
+    }
+
+    // accept the connections to a socket, never returns
+    void accept_connections(int fd) {
+        for (;;) {
+            int c = accept(fd, 0, 0);
+            if ( c == -1 ) {
+                if ( errno == EINTR || errno == ECONNABORTED ) {
+                    continue;
+                }
+                fprintf(stderr, "Error accepting a connection: %s\n", strerror(errno));
+                exit(0);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                readers++;
+            }
+            std::thread reader(&Server::read_connection, this, new Connection(c, c));
+            reader.detach();
+        }
+    }
+
+    // the listener is done (there is none for stdin)
+    void no_listener() {
+        std::lock_guard<std::mutex> lock(mtx);
+        readers--;
+    }
+
+    // solve the queued requests until all readers are done.
+    // returns the number of puzzles solved.
+    size_t solve_requests(const schoku_opts &opts, Stats &stats) {
+        size_t rsize = schoku_record_size(opts.output_format);
+        size_t npuzzles = 0;
+        std::vector<Request> batch;
+        std::vector<signed char> in;
+        std::vector<signed char> out;
+        std::string response;
+
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                work.wait(lock, [&] { return !requests.empty() || readers == 0; });
+                if ( requests.empty() ) {
+                    break;
+                }
+                batch.swap(requests);
+                in.swap(puzzles);
+                requests.clear();
+                puzzles.clear();
+                space.notify_all();
+            }
+            size_t n = in.size()/82;
+            out.resize(n*rsize);
+            if ( n ) {
+                solve_batch(in.data(), n, out.data(), opts, stats, npuzzles+1);
+                npuzzles += n;
+            }
+
+            // the responses, one write per run of requests of the same connection
+            const signed char *record = out.data();
+            for (size_t k = 0; k < batch.size(); k++) {
+                Request &req = batch[k];
+                response += req.id;
+                response += ' ';
+                if ( req.valid ) {
+                    response.append((const char *)record, rsize);
+                    record += rsize;
+                } else {
+                    response += "error: not a puzzle of 81 characters\n";
+                }
+                if ( k+1 == batch.size() || batch[k+1].conn != req.conn ) {
+                    req.conn->send(response.data(), response.size());
+                    response.clear();
+                }
+            }
+            for (Request &req : batch) {
+                req.conn->release();
+            }
+            batch.clear();
+        }
+        return npuzzles;
+    }
+};
+
+// open the socket to listen on: [host]:port for TCP (by default on the loopback interface),
+// otherwise the path of a Unix socket.
+int server_listen(const char *addr) {
+    int fd;
+    const char *colon = strrchr(addr, ':');
+    if ( colon ) {
+        struct sockaddr_in sin {};
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(atoi(colon+1));
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string host(addr, colon-addr);
+        if ( host.size() && inet_pton(AF_INET, host.c_str(), &sin.sin_addr) != 1 ) {
+            fprintf(stderr, "Error: %s is not an IPv4 address\n", host.c_str());
+            exit(0);
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if ( fd == -1 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ) {
+            fprintf(stderr, "Error binding to %s: %s\n", addr, strerror(errno));
+            exit(0);
+        }
+    } else {
+        struct sockaddr_un sun {};
+        sun.sun_family = AF_UNIX;
+        if ( strlen(addr) >= sizeof(sun.sun_path) ) {
+            fprintf(stderr, "Error: the socket path %s is too long\n", addr);
+            exit(0);
+        }
+        strcpy(sun.sun_path, addr);
+        unlink(addr);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ( fd == -1 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1 ) {
+            fprintf(stderr, "Error binding to %s: %s\n", addr, strerror(errno));
+            exit(0);
+        }
+    }
+    if ( listen(fd, 128) == -1 ) {
+        fprintf(stderr, "Error listening on %s: %s\n", addr, strerror(errno));
+        exit(0);
+    }
+    return fd;
+}
+
+// run the server on addr, or on stdin and stdout if addr is empty.
+// The messages of the solver go to stderr if the responses go to stdout.
+// returns the number of puzzles solved (only for stdin).
+//
+size_t serve(const char *addr, const schoku_opts &opts, Stats &stats) {
+    // a client going away must not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    Server *server = new Server;
+    if ( *addr == 0 ) {
+        int fdout = dup(1);
+        dup2(2, 1);
+        server->no_listener();
+        server->serve_stdin(fdout);
+    } else {
+        int fd = server_listen(addr);
+        std::thread listener(&Server::accept_connections, server, fd);
+        listener.detach();
+    }
+    size_t npuzzles = server->solve_requests(opts, stats);
+    delete server;
+    return npuzzles;
+}
+
+// windowed output (-W)
+// The output file is mapped and solved in windows of window_mb MB (a multiple of the page size in
+// puzzles, so the windows start on a page), instead of mapping the whole output at once.
+// Once a window is solved, its mapping is synced and unmapped and its write back is started,
+// the pages of the window before (which are written back by then) are dropped from the page cache,
+// and the pages of the input before the next window are released.  So at most the pages of two
+// windows are dirty or cached at any time, with steady write back as the solving moves on.
+// fdout is the output file (of the size of the n records), in the mapped input that starts at input_map.
+//
+void solve_windowed(const signed char *in, size_t n, const size_t *index, signed char *input_map, int fdout, const char *ofn,
+                    int window_mb, const schoku_opts &opts, Stats &stats) {
+    size_t rsize = schoku_record_size(opts.output_format);
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t window = ((size_t)window_mb << 20) / rsize / page * page;
+    if ( window == 0 ) {
+        window = page;
+    }
+    size_t released = 0;    // the input pages released so far
+    for (size_t first = 0; first < n; first += window) {
+        size_t count = std::min(window, n-first);
+        signed char *output = (signed char *)mmap((void*)0, count*rsize, PROT_WRITE, MAP_SHARED, fdout, first*rsize);
+        if ( output == MAP_FAILED ) {
+            printf("Error mmap of output file %s: %s\n", ofn, strerror(errno));
+            exit(0);
+        }
+        if ( index ) {
+            solve_batch(in, count, output, opts, stats, 1+first, 0, &index[first]);
+        } else {
+            solve_batch(&in[first*82], count, output, opts, stats, 1+first);
+        }
+        msync(output, count*rsize, MS_ASYNC);
+        if ( munmap(output, count*rsize) == -1 ) {
+            printf("Error munmap file %s: %s\n", ofn, strerror(errno));
+        }
+        // write back this window, drop the window before
+        sync_file_range(fdout, first*rsize, count*rsize, SYNC_FILE_RANGE_WRITE);
+        if ( first ) {
+            sync_file_range(fdout, (first-window)*rsize, window*rsize,
+                            SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE|SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(fdout, (first-window)*rsize, window*rsize, POSIX_FADV_DONTNEED);
+        }
+        // the input before the next window
+        if ( first+count < n ) {
+            const signed char *next = index ? &in[index[first+count]] : &in[(first+count)*82];
+            size_t end = (next - input_map) / page * page;
+            if ( end > released ) {
+                madvise(input_map + released, end - released, MADV_DONTNEED);
+                released = end;
+            }
+        }
+    }
+}
+
+// verification mode (-V)
+// Checks the records of a solution file (-f0: the puzzle, a comma, the solution and a newline)
+// without solving them: each solution must be a valid grid and agree with the clues of its puzzle.
+// The cells of a solution are compared to each digit 32 at a time, which gives the bit vector of
+// the cells of the digit.  If all 81 cells are digits and the cells of every digit cover all rows,
+// columns and boxes, each digit occupies exactly one cell per row, column and box.
+// The records are checked in chunks by all threads.
+//
+#define VERIFY_RECORD 164
+
+typedef
+enum RecordCheck {
+   RecordOK      = 0,
+   RecordFormat  = 1,   // not a puzzle, a comma, a solution and a newline
+   RecordInvalid = 2,   // the solution is not a valid grid
+   RecordClues   = 3,   // the solution does not agree with the clues of the puzzle
+} RecordCheck;
+
+// rec is read up to byte 177, i.e. into the next record
+inline RecordCheck verify_record(const signed char *rec) {
+    if ( rec[81] != ',' || rec[VERIFY_RECORD-1] != 10 ) {
+        return RecordFormat;
+    }
+    const __uint128_t all = ((__uint128_t)1<<81)-1;
+    __m256i p[3], c[3];
+    for (unsigned char j = 0; j < 3; j++) {
+        p[j] = _mm256_loadu_si256((__m256i_u*) &rec[j*32]);
+        c[j] = _mm256_loadu_si256((__m256i_u*) &rec[82+j*32]);
+    }
+    // the cells with a digit, the clues that differ from the solution
+    bit128_t digits, clues;
+    for (unsigned char j = 0; j < 3; j++) {
+        __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(c[j], _mm256_set1_epi8('0')),
+                                            _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), c[j]));
+        // anything else than a digit is a blank of the puzzle (as with copy_puzzle)
+        __m256i is_clue = _mm256_and_si256(_mm256_cmpgt_epi8(p[j], _mm256_set1_epi8('0')),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), p[j]));
+        digits.u32[j] = _mm256_movemask_epi8(is_digit);
+        clues.u32[j] = _mm256_movemask_epi8(_mm256_andnot_si256(_mm256_cmpeq_epi8(p[j], c[j]), is_clue));
+    }
+    digits.u32[3] = clues.u32[3] = 0;
+    if ( (digits.u128 & all) != all ) {
+        return RecordInvalid;
+    }
+    if ( clues.u128 & all ) {
+        return RecordClues;
+    }
+
+    // the first cells of the rows and of the boxes
+    const __uint128_t rows  = 0x8040201008040201ULL | ((__uint128_t)1<<72);
+    const __uint128_t boxes = 0x49 | (0x49ULL<<27) | (0x49ULL<<54);
+    for (unsigned char d = 0; d < 9; d++) {
+        bit128_t m;
+        for (unsigned char j = 0; j < 3; j++) {
+            m.u32[j] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c[j], _mm256_set1_epi8('1'+d)));
+        }
+        m.u32[3] = 0;
+        __uint128_t cd = m.u128 & all;
+        // fold the 9 cells of each row, column and box onto its first cell
+        __uint128_t r = cd | (cd >> 1);
+        r |= r >> 2;
+        r |= (r >> 4) | (cd >> 8);
+        __uint128_t k = cd | (cd >> 9);
+        k |= k >> 18;
+        k |= (k >> 36) | (cd >> 72);
+        __uint128_t b = cd | (cd >> 1) | (cd >> 2);
+        b |= (b >> 9) | (b >> 18);
+        if ( (r & rows) != rows || (k & 0x1ff) != 0x1ff || (b & boxes) != boxes ) {
+            return RecordInvalid;
+        }
+    }
+    return RecordOK;
+}
+
+// check the n records of buf (size bytes), report the failing lines.
+// returns the number of failed records.
+size_t verify_file(const signed char *buf, size_t size, const schoku_opts &opts, FILE *report) {
+    const char *reasons[] = { "", "not a puzzle and its solution", "the solution is not a valid grid",
+                              "the solution does not agree with the puzzle" };
+    size_t n = size / VERIFY_RECORD;
+    int nthreads = opts.numthreads ? opts.numthreads : omp_get_max_threads();
+    std::vector<std::pair<size_t, RecordCheck>> failed;
+
+#pragma omp parallel num_threads(nthreads) shared(buf, n, failed)
+    {
+        std::vector<std::pair<size_t, RecordCheck>> local;
+#pragma omp for schedule(dynamic,1024) nowait
+        for (size_t i = 0; i < n; i++) {
+            const signed char *rec = &buf[i*VERIFY_RECORD];
+            signed char last[VERIFY_RECORD+32];
+            if ( i == n-1 ) {
+                // do not read beyond the end of the mapping
+                memcpy(last, rec, VERIFY_RECORD);
+                rec = last;
+            }
+            RecordCheck check = verify_record(rec);
+            if ( check != RecordOK ) {
+                local.push_back({i+1, check});
+            }
+        }
+#pragma omp critical
+        failed.insert(failed.end(), local.begin(), local.end());
+    }
+    if ( size % VERIFY_RECORD ) {
+        failed.push_back({n+1, RecordFormat});
+    }
+
+    std::sort(failed.begin(), failed.end());
+    for (auto &f : failed) {
+        fprintf(report, "Line %ld: %s\n", f.first, reasons[f.second]);
+    }
+    fprintf(report, "%10ld  records checked\n", n + (size % VERIFY_RECORD ? 1 : 0));
+    if ( failed.size() ) {
+        fprintf(report, "%10ld  records failed verification\n", failed.size());
+    }
+    return failed.size();
+}
+
+// generator mode (-G)
+// Generates minimal puzzles with the solver.  A solved grid is the solution of a grid with random
+// digits in the three boxes of the diagonal (which cannot conflict).  Its clues are removed one
+// at a time, or by pairs of cells of 180 degree rotational symmetry, in random order.  A removal is
+// kept if the puzzle still has a unique solution.  A clue that cannot be removed cannot be removed
+// later either, so one pass leaves a minimal puzzle.  With pairs, the puzzle is minimal under
+// the removal of pairs only: a single clue of a pair can often still be removed.  Such a removal
+// would break the symmetry, so it is not made.
+// A puzzle with more than max_clues clues, or that takes the solver less than min_guesses guesses
+// (a measure of its difficulty), is discarded and another grid is tried, up to GENERATE_TRIES times.
+// Each thread keeps its GridState stack and its solvers for all the steps.
+//
+#define GENERATE_TRIES 10000
+
+// a small random number generator (splitmix64)
+class Random
+{
+public:
+    unsigned long long state;
+
+    Random(unsigned long long seed) : state(seed) {}
 
-                for (unsigned char i = 0; i < 2; i++) {
-                    unsigned long long m = ~((bit128_t*)unlocked)->u64[i];
-                    if ( m ) {
-                        m |= bivalues.u64[i];
-                        unsigned char pc = __popcnt64(m);
-                        sum12s += pc;
-                        if ( pc != 64 ) {
-                            if ( pc < 63 || not_pairs++ ) {
-                                goto guess;
-                            }
-                            target = (i<<6) + __tzcnt_u64(~m);
-                        }
-                    }
-                }
-                // sum12s is the total of 128 bits minus the ones that are neither 1 or 2
-                sum12s -= (64-17);    // only 81 possible bits, subtract 64-17 to compensate
-                if ( sum12s == 81 ) { // this means Q == 0
-                    if ( unique_check ) {
-                        if ( verbose && debug ) {
-                            printf("bi-value universal grave means at least two solutions exist.\n");
-                        }
-                        goto guess;
-                    } else if ( grid_state->stackpointer ) {
-                        if ( verbose && debug ) {
-                            printf("back track - found a bi-value universal grave.\n");
-                        }
-                        goto back;
-                    } else {
-                        if ( verbose && debug ) {
-                            printf("bi-value universal grave means at least two solutions exist.\n");
-                            non_unique_count++;
-                        }
-                        goto guess;
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    // shuffle a[0..n-1]
+    void shuffle(unsigned char *a, int n) {
+        for (int i = n-1; i > 0; i--) {
+            std::swap(a[i], a[next() % (i+1)]);
+        }
+    }
+};
+
+// generate n puzzles into out (82 bytes each, the puzzle and a newline),
+// returns the number of puzzles generated (the others are left out).
+// tries receives the number of grids tried, clues the total of the clues of the puzzles.
+size_t generate_puzzles(size_t n, int max_clues, int min_guesses, bool symmetric, unsigned long long seed,
+                        const schoku_opts &opts, Stats &stats, signed char *out, long &tries, long &clues) {
+    int nthreads = opts.numthreads ? opts.numthreads : omp_get_max_threads();
+    bool use_avx512 = avx512_support && !opts.no_avx512;
+    std::vector<unsigned char> generated(n);
+
+    // the uniqueness checks
+    schoku_opts check_opts {};
+    check_opts.unique_check = 1;
+    check_opts.no_avx512 = opts.no_avx512;
+    check_opts.trail = opts.trail;
+    // the solved grids and the difficulty
+    schoku_opts solve_opts {};
+    solve_opts.no_avx512 = opts.no_avx512;
+    solve_opts.trail = opts.trail;
+
+    tries = 0;
+    clues = 0;
+#pragma omp parallel num_threads(nthreads) proc_bind(close) shared(generated, out, tries, clues)
+    {
+        Stats my_stats;
+        Stats check_stats;     // not reported
+        long my_tries = 0;
+        long my_clues = 0;
+        Solver solver = get_solver(false, use_avx512, default_strategies);
+        GridState *stack = get_thread_stack();
+
+        // solve grid in place, returns true if the solution is unique
+        auto unique = [&](const signed char *puzzle) {
+            signed char grid[81];
+            memcpy(grid, puzzle, 81);
+            long non_unique = check_stats.non_unique_count;
+            stack[0].initialize(grid);
+            solver(grid, stack, 0, check_opts, check_stats, 0, 0);
+            return check_stats.non_unique_count == non_unique;
+        };
+
+#pragma omp for schedule(dynamic,1) nowait
+        for (size_t k = 0; k < n; k++) {
+            // the same puzzles for a seed, whatever the threads
+            Random random(seed ^ (k * 0xd1342543de82ef95ULL));
+            signed char *puzzle = &out[k*82];
+            for (int t = 0; t < GENERATE_TRIES && !generated[k]; t++) {
+                my_tries++;
+                // a solved grid
+                signed char grid[81];
+                memset(grid, '.', 81);
+                for (unsigned char b = 0; b < 9; b += 4) {
+                    unsigned char digits[9] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+                    random.shuffle(digits, 9);
+                    for (unsigned char j = 0; j < 9; j++) {
+                        grid[box_start_by_boxindex[b] + box_offset[j]] = '0' + digits[j];
                     }
                 }
+                stack[0].initialize(grid);
+                solver(grid, stack, 0, solve_opts, check_stats, 0, 0);
 
-                if ( sum12s == 80 && __popcnt16(candidates[target]) == 3 ) {
-                    unsigned char row = row_index[target];
-                    unsigned short cand3 = candidates[target];
-                    unsigned short digit = 0;
-                    unsigned short mask = ((bit128_t*)unlocked)->get_indexbits(row*9,9);
-                    __m256i maskv = expand_bitvector(mask);
-                    __m256i c = _mm256_and_si256(_mm256_load_si256((__m256i*) &candidates[row*9]), maskv);
-                    while (cand3) {
-                        unsigned short canddigit = cand3 & (-cand3);
-                        // count cells with this candidate digit:
-                        __m256i tmp = _mm256_and_si256(_mm256_set1_epi16(canddigit), c);
-                        // as a boolean
-                        tmp = _mm256_cmpeq_epi16(tmp,_mm256_setzero_si256());
-                        // need three cell, doubled bits in mask:
-                        if ( _popcnt32(~_mm256_movemask_epi8(tmp)) == 3*2 ) {
-                            digit = canddigit;
-                            break;
-                        };
-                        cand3 &= ~canddigit;
+                // remove the clues
+                unsigned char cells[81];
+                for (unsigned char j = 0; j < 81; j++) {
+                    cells[j] = j;
+                }
+                random.shuffle(cells, 81);
+                memcpy(puzzle, grid, 81);
+                puzzle[81] = 10;
+                int nclues = 81;
+                for (unsigned char j = 0; j < 81; j++) {
+                    unsigned char c = cells[j];
+                    unsigned char c2 = symmetric ? 80-c : c;
+                    if ( c > c2 ) {
+                        // the pair is removed with c2
+                        continue;
                     }
-                    if ( digit ) {
-                        bug_count++;
-                        if ( verbose && debug ) {
-                            printf("bi-value universal grave pivot:");
-                        }
-                        e_i = target;
-                        e_digit = digit;
-                        goto enter;
+                    puzzle[c] = puzzle[c2] = '.';
+                    if ( unique(puzzle) ) {
+                        nclues -= c == c2 ? 1 : 2;
+                    } else {
+                        puzzle[c] = grid[c];
+                        puzzle[c2] = grid[c2];
                     }
                 }
+                if ( nclues > max_clues ) {
+                    continue;
+                }
+                // the difficulty
+                long long guesses = my_stats.guesses;
+                memcpy(grid, puzzle, 81);
+                stack[0].initialize(grid);
+                solver(grid, stack, 0, solve_opts, my_stats, 0, 0);
+                if ( my_stats.guesses - guesses < min_guesses ) {
+                    my_stats.guesses = guesses;
+                    continue;
+                }
+                my_stats.solved_count++;
+                my_clues += nclues;
+                generated[k] = 1;
+            }
+        }
+#pragma omp critical
+        {
+            stats.add(my_stats);
+            tries += my_tries;
+            clues += my_clues;
         }
     }
 
-guess:
+    // leave out the puzzles that were not generated
+    size_t m = 0;
+    for (size_t k = 0; k < n; k++) {
+        if ( generated[k] ) {
+            if ( m != k ) {
+                memcpy(&out[m*82], &out[k*82], 82);
+            }
+            m++;
+        }
+    }
+    return m;
+}
 
-    // Make a guess if all that didn't work
-    grid_state = grid_state->make_guess<verbose>(triad_info, bivalues);
-    current_entered_count += 0x101;     // increment high byte for the new grid_state, plus one for the guess made.
-    no_guess_incr = 0;
-    goto start;
+// batch mode (-M)
+// solve the puzzles of several input files as one batch, so the threads go from the puzzles
+// of one file to those of the next, and write the solutions of each to its output file.
+// The files are the lines of the manifest (an input file name, optionally followed by
+// a space and the output file name), or the nfiles names of files without a manifest.
+// An input file without an output file name is solved to its name followed by ".solutions".
+// A header line (shorter than a puzzle) and comments are skipped as with a single file.
+// The line numbers of the messages count the puzzles of all the files, in order.
+// A file that cannot be read or written is reported and skipped, the others are solved.
+// Returns the number of puzzles, failed is the number of files skipped.
+//
+size_t solve_files(const char *manifest, int nfiles, const char *files[], const schoku_opts &opts, Stats &stats, size_t &failed) {
+    std::vector<std::string> ifns, ofns;
+    if ( manifest ) {
+        FILE *f = fopen(manifest, "r");
+        if ( f == 0 ) {
+            fprintf(stderr, "Error: Failed to open file %s: %s\n", manifest, strerror(errno));
+            exit(1);
+        }
+        char line[PATH_MAX*2+2];
+        while ( fgets(line, sizeof(line), f) ) {
+            char *ifn = strtok(line, " \t\r\n");
+            if ( ifn == 0 || *ifn == '#' ) {
+                continue;
+            }
+            char *ofn = strtok(0, " \t\r\n");
+            ifns.push_back(ifn);
+            ofns.push_back(ofn ? ofn : ifns.back() + ".solutions");
+        }
+        fclose(f);
+    } else {
+        for (int k = 0; k < nfiles; k++) {
+            ifns.push_back(files[k]);
+            ofns.push_back(ifns.back() + ".solutions");
+        }
+    }
+
+    // read all the files into one buffer
+    size_t nf = ifns.size();
+    std::vector<size_t> offsets(nf+1, 0);
+    std::vector<int> fds(nf);
+    failed = 0;
+    for (size_t k = 0; k < nf; k++) {
+        offsets[k+1] = offsets[k];
+        fds[k] = open(ifns[k].c_str(), O_RDONLY);
+        struct stat sb;
+        if ( fds[k] == -1 || fstat(fds[k], &sb) == -1 ) {
+            fprintf(stderr, "Error: Failed to open file %s: %s, skipped\n", ifns[k].c_str(), strerror(errno));
+        } else if ( !S_ISREG(sb.st_mode) ) {
+            fprintf(stderr, "Error: -M requires regular files (%s), skipped\n", ifns[k].c_str());
+        } else {
+            offsets[k+1] = offsets[k] + sb.st_size;
+            continue;
+        }
+        if ( fds[k] != -1 ) {
+            close(fds[k]);
+        }
+        fds[k] = -1;
+        failed++;
+    }
+    // the slack covers the vector loads of the last puzzle
+    signed char *in = (signed char *)malloc(offsets[nf] + 64);
+    for (size_t k = 0; k < nf; k++) {
+        if ( fds[k] != -1 ) {
+            offsets[k+1] = offsets[k] + read_fully(fds[k], &in[offsets[k]], offsets[k+1]-offsets[k]);
+            close(fds[k]);
+        } else {
+            offsets[k+1] = offsets[k];
+        }
+    }
+
+    // the puzzles of all the files
+    std::vector<size_t> index;
+    std::vector<size_t> first(nf+1, 0);         // the puzzles of file k are first[k] - first[k+1]-1
+    for (size_t k = 0; k < nf; k++) {
+        size_t npuzzles = 0;
+        size_t skipped = 0;
+        std::vector<size_t> file_index = index_puzzles(&in[offsets[k]], offsets[k+1] - offsets[k], npuzzles, skipped);
+        if ( skipped ) {
+            fprintf(stderr, "%s: found %ld puzzles, skipped %ld lines with less than 81 characters\n", ifns[k].c_str(), npuzzles, skipped);
+        }
+        for (size_t j = 0; j < npuzzles; j++) {
+            index.push_back(offsets[k] + (file_index.empty() ? j*82 : file_index[j]));
+        }
+        first[k+1] = first[k] + npuzzles;
+    }
+
+    size_t n = first[nf];
+    size_t rsize = schoku_record_size(opts.output_format);
+    signed char *out = (signed char *)malloc(n*rsize + 1);
+    solve_batch(in, n, out, opts, stats, 1, 0, index.data());
+
+    for (size_t k = 0; k < nf; k++) {
+        if ( fds[k] == -1 ) {
+            continue;
+        }
+        int fdout = open(ofns[k].c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0775);
+        if ( fdout == -1 ) {
+            fprintf(stderr, "Error opening output file %s: %s, skipped\n", ofns[k].c_str(), strerror(errno));
+            failed++;
+            continue;
+        }
+        write_fully(fdout, &out[first[k]*rsize], (first[k+1]-first[k])*rsize);
+        close(fdout);
+    }
+    free(out);
+    free(in);
+    return n;
+}
+
+// benchmark mode (-b)
+// solve the puzzles warmups+iterations times, the warm-up iterations are not measured.
+// The statistics (stats) are those of the last iteration, starttime is set to its start.
+// Reports the throughput, the latency percentiles of the puzzles and the slowest lines.
+//
+void run_benchmark(const signed char *in, size_t n, const size_t *index, signed char *out, const schoku_opts &opts, Stats &stats, size_t line,
+                   int iterations, int warmups, std::chrono::steady_clock::time_point &starttime, FILE *report) {
+    Latency *latency = new Latency;
+    std::vector<long long> duration;   // ns per measured iteration
+
+    for (int k = 0; k < warmups+iterations; k++) {
+        Stats iteration_stats;
+        auto start = std::chrono::steady_clock::now();
+        solve_batch(in, n, out, opts, iteration_stats, line, k < warmups ? 0 : latency, index);
+        if ( k >= warmups ) {
+            duration.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        if ( k == warmups+iterations-1 ) {
+            stats.add(iteration_stats);
+            starttime = start;
+        }
+    }
 
+    long long total = 0;
+    for (long long d : duration) {
+        total += d;
+    }
+    std::sort(duration.begin(), duration.end());
+
+    fprintf(report, "benchmark: %d iterations of %ld puzzles, %d warm-up iterations not measured\n", iterations, n, warmups);
+    fprintf(report, "%10.0lf  puzzles/s\n", (double)n*iterations/((double)total/1000000000LL));
+    if ( opts.interleave > 1 ) {
+        // the same one puzzle at a time
+        schoku_opts single = opts;
+        single.interleave = 0;
+        long long single_total = 0;
+        for (int k = 0; k < warmups+iterations; k++) {
+            Stats iteration_stats;
+            auto start = std::chrono::steady_clock::now();
+            solve_batch(in, n, out, single, iteration_stats, line, 0, index);
+            if ( k >= warmups ) {
+                single_total += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+        fprintf(report, "%10.0lf  puzzles/s one puzzle at a time (speedup of -i%d: %.2lfx)\n", (double)n*iterations/((double)single_total/1000000000LL),
+                opts.interleave, (double)single_total/total);
+    }
+    fprintf(report, "%8.1lfms  best iteration\n", (double)duration.front()/1000000);
+    fprintf(report, "%8.1lfms  median iteration\n", (double)duration[duration.size()/2]/1000000);
+    fprintf(report, "%8.2lf\u00b5s  mean latency\n", (double)latency->total/latency->count/1000);
+    fprintf(report, "%8.2lf\u00b5s  p50 latency\n", latency->percentile(50)/1000.0);
+    fprintf(report, "%8.2lf\u00b5s  p99 latency\n", latency->percentile(99)/1000.0);
+    fprintf(report, "%8.2lf\u00b5s  p99.9 latency\n", latency->percentile(99.9)/1000.0);
+    fprintf(report, "%8.2lf\u00b5s  max latency\n", latency->percentile(100)/1000.0);
+    fprintf(report, "slowest lines:");
+    for (int k = 0; k < LATENCY_SLOWEST && latency->slowest_ns[k]; k++) {
+        fprintf(report, " %ld (%.1lf\u00b5s)", latency->slowest_line[k], latency->slowest_ns[k]/1000.0);
+    }
+    fprintf(report, "\n");
+    delete latency;
 }
 
 void print_help() {
@@ -2632,16 +6590,84 @@ void print_help() {
 fastss [options] [puzzles] [solutions]
 \t [puzzles] names the input file with puzzles. Default is 'puzzles.txt'.
 \t [solutions] names the output file with solutions. Default is 'solutions.txt'.
+\t '-' writes the solutions to stdout.  Output to stdout, a pipe or a device is written
+\t in input order as the threads complete the puzzles.
+\t With -s and stdout as output, the statistics and the messages are written to stderr.
 
 Command line options:
+    -a  use the AVX2 code path even if AVX-512 is available
+    -b#[,#] benchmark: solve the puzzles # times (default 10) after # warm-up runs (default 1),
+        report the throughput, the latency percentiles and the slowest lines.  Not with -s.
     -c  check for back tracking even when no guess was made (e.g. if puzzles might have no solution)
     -d# provide some detailed information on the progress of the puzzle solving.
         add a 2 for even more detail.
+    -e[s][t][f] the strategies besides singles and triads: s for naked sets, t for triad resolution,
+        f for fish (x-wings and swordfish), e.g. -est for the first two.
+        -ea tries all combinations on the first puzzles and keeps the fastest.
+        The default is given at compile time (OPT_SETS, OPT_TRIAD_RES, OPT_FISH).
+    -f# output format: 0 the puzzle, a comma and the solution (default)
+                       1 the solution only
+                       2 the solution packed into 41 bytes, 4 bits per cell (binary)
+    -g# engine: 0 cell-major (default)
+                1 digit-major: a plane of 81 bits per digit, singles and guesses only
+                2 hybrid: cell-major until the first guess, then digit-major
+        The strategies (-e) and the parallel search (-p) are those of the cell-major engine.
+    -G[s]#[,#[,#[,#]]] generator mode: generate # minimal puzzles (default 1000) with at most # clues
+        and at least # guesses by the solver (the difficulty), from the random seed # (default from
+        the clock).  The clues of a random solved grid are removed in random order (s: by pairs of
+        180 degree rotational symmetry, the puzzles are then minimal under symmetric pair removal,
+        not for single clues) if the puzzle stays unique.  The seed is reported, the same
+        seed generates the same puzzles.  The first file name is the output file, the default is stdout.
     -h  help information (this text)
+    -i[#] interleaved: each thread advances # puzzles (2 to 4, default 4) in turn, a step of the search
+        of each, so the work of the puzzles overlaps.  Requires -g1, the default cell-major solver
+        is not interleaved.  Not with -m or -n.
+        With -b, the throughput is also measured one puzzle at a time for comparison.
+    -k[#] probe before a guess: the candidates of the first # (default 4) bi-value cells are entered
+        on a copy and the singles propagated, a candidate that fails is removed, otherwise
+        the candidate that solves the most cells is the guess.
     -l# solve a single line from the puzzle.
+    -m# cache the solutions of up to # puzzles (default 65536), puzzles that are the same up to
+        relabeling digits, swapping rows, columns, bands or stacks, or transposing are solved once.
+        Not with -d, -p or -u#.
+    -M[manifest] batch mode: solve the puzzles of several files in one run, the threads go on from
+        one file to the next.  The file names are the input files, or each line of the manifest
+        names an input file and optionally (after a space) its output file.  The default output
+        file is the name of the input file followed by ".solutions".  The line numbers of
+        the messages count the puzzles of all the files.  A file that cannot be read or written
+        is skipped, the exit status is 1 then.  Not with -b, -l, -w, -V or -W.
+    -n  NUMA mode: split the puzzles into a range per NUMA node, solved by threads bound to the node
+        from copies of the puzzles in its memory.  Not with -d or output to stdout or a pipe.
+    -o# schedule of the puzzles to the threads: 0 in order, in chunks of 64 (default)
+                                                1 in order, in chunks getting smaller towards the end
+                                                2 puzzles with the fewest clues first
+                                                3 work stealing: a range of pages of the output per
+                                                  thread, idle threads steal half of another range
+    -p  parallel search: threads without puzzles search branches of the puzzles of others,
+        e.g. for -l or hard puzzles.  With the cell-major engine (-g0) only, not with -d, -f2, -r
+        or output to stdout or a pipe (except in streaming mode).
+    -r  trail mode: save only the changing parts of the state for a guess on a trail,
+        instead of copying the complete state.  Lifts the limit on the levels of guesses.
+    -s  streaming mode: read and write the puzzles in chunks, the defaults are stdin and stdout.
+        This is implied if the input is not a regular file (e.g. a pipe).
     -t# set the number of threads
-    -u  check the solution for uniqueness
+    -u[#] check the solution for uniqueness, the search stops at the second solution.
+        With #, count the solutions of each puzzle up to # and report the count per line,
+        "Line n: k of at most # solutions counted" (k = # means # or more), in place of the other
+        messages of the puzzle about its solutions.
     -v  verify the solution
+    -V  verify the records of a solution file (the default format, -f0) instead of solving:
+        the solutions must be valid grids and agree with their puzzles, the failing lines are reported.
+        The file is the first file name.  The exit status is 1 if any record fails.
+    -w[address] server mode: solve the puzzles of requests until the end of the input,
+        a line with a puzzle, optionally preceded by an identifier and a space, per request.
+        The response is the identifier (by default the line number), a space and the solution.
+        The requests come from stdin, or from the connections to the socket given by
+        [host]:port (TCP, by default on the loopback interface) or by a path (Unix socket).
+        Not with -b or -f2.
+    -W[#] windowed output: map and solve the output file in windows of # MB (default 256) in turn,
+        each window is written back and dropped from the page cache once solved,
+        e.g. for outputs larger than the memory.  Not with -b or -l.
     -x  provide some statistics
 
 )");
@@ -2650,6 +6676,21 @@ Command line options:
 int main(int argc, const char *argv[]) {
 
     int line_to_solve = 0;
+    int streaming = 0;
+    int verify_file_only = 0;
+    int window_mb = 0;
+    int batch = 0;
+    const char *manifest = 0;
+    int generate = 0;
+    int generate_clues = 81;
+    int generate_guesses = 0;
+    unsigned long long generate_seed = 0;
+    bool generate_seeded = false;
+    bool generate_symmetric = false;
+    const char *server_addr = 0;
+    int iterations = 0;
+    int warmups = 1;
+    schoku_opts opts {};
 
     if ( argc > 0 ) {
         argc--;
@@ -2662,13 +6703,60 @@ int main(int argc, const char *argv[]) {
             break;
         }
         switch(argv[0][1]) {
+        case 'a':
+             opts.no_avx512=1;
+             break;
+        case 'b':    // benchmark
+             iterations=10;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d,%d", &iterations, &warmups);
+             }
+             break;
         case 'c':
-             thorough_check=1;
+             opts.thorough_check=1;
              break;
         case 'd':
-             debug=1;
+             opts.debug=1;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.debug);
+             }
+             break;
+        case 'e':    // strategies
+             if ( argv[0][2] == 'a' ) {
+                 opts.strategies = SCHOKU_STRATEGY_AUTO;
+             } else {
+                 opts.strategies = SCHOKU_STRATEGY_SELECTED;
+                 for (const char *c = &argv[0][2]; *c; c++) {
+                     if ( *c == 's' ) {
+                         opts.strategies |= SCHOKU_STRATEGY_SETS;
+                     } else if ( *c == 't' ) {
+                         opts.strategies |= SCHOKU_STRATEGY_TRIAD_RES;
+                     } else if ( *c == 'f' ) {
+                         opts.strategies |= SCHOKU_STRATEGY_FISH;
+                     }
+                 }
+             }
+             break;
+        case 'f':    // output format
              if ( argv[0][2] && isdigit(argv[0][2]) ) {
-                 sscanf(&argv[0][2], "%d", &debug);
+                 sscanf(&argv[0][2], "%d", &opts.output_format);
+             }
+             break;
+        case 'g':    // engine
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.engine);
+             }
+             break;
+        case 'k':    // probing
+             opts.probe = 4;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.probe);
+             }
+             break;
+        case 'i':    // interleaved solving
+             opts.interleave = 4;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.interleave);
              }
              break;
         case 'h':
@@ -2676,23 +6764,77 @@ int main(int argc, const char *argv[]) {
              exit(0);
              break;
         case 'u':    // verify uniqueness, check for multiple solutions
-             unique_check=1;
+             opts.unique_check=1;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.solution_limit);
+             }
+             break;
+        case 'G':    // generator mode
+             {
+                 const char *c = &argv[0][2];
+                 if ( *c == 's' ) {
+                     generate_symmetric = true;
+                     c++;
+                 }
+                 generate = 1000;
+                 if ( isdigit(*c) ) {
+                     generate_seeded = sscanf(c, "%d,%d,%d,%llu", &generate, &generate_clues, &generate_guesses, &generate_seed) == 4;
+                 }
+             }
+             break;
+        case 'M':    // batch mode
+             batch = 1;
+             if ( argv[0][2] ) {
+                 manifest = &argv[0][2];
+             }
+             break;
+        case 'W':    // windowed output
+             window_mb = 256;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &window_mb);
+             }
+             break;
+        case 'V':    // verify a solution file
+             verify_file_only=1;
              break;
         case 'v':    // verify
-             verify=1;
+             opts.verify=1;
+             break;
+        case 'w':    // server mode
+             server_addr = &argv[0][2];
              break;
         case 'x':    // stats output
-             reportstats=1;
+             opts.reportstats=1;
              break;
         case 'l':    // line of puzzle to solve
              sscanf(argv[0]+2, "%d", &line_to_solve);
              break;
+        case 'm':    // solution cache
+             opts.cache_size=65536;
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.cache_size);
+             }
+             break;
+        case 'o':    // schedule
+             if ( argv[0][2] && isdigit(argv[0][2]) ) {
+                 sscanf(&argv[0][2], "%d", &opts.schedule);
+             }
+             break;
+        case 'n':    // NUMA mode
+             opts.numa=1;
+             break;
+        case 'p':    // parallel search
+             opts.parallel_search=1;
+             break;
+        case 'r':    // trail mode
+             opts.trail=1;
+             break;
+        case 's':    // streaming mode
+             streaming=1;
+             break;
         case 't':    // set number of threads
              if ( argv[0][2] && isdigit(argv[0][2]) ) {
-                 sscanf(&argv[0][2], "%d", &numthreads);
-                 if ( numthreads != 0 ) {
-                     omp_set_num_threads(numthreads);
-                 }
+                 sscanf(&argv[0][2], "%d", &opts.numthreads);
              }
              break;
         }
@@ -2703,31 +6845,87 @@ int main(int argc, const char *argv[]) {
 
    // sort out the CPU and OMP settings
 
-   if ( !__builtin_cpu_supports("avx2") ) {
-        printf("This program requires a CPU with the AVX2 instruction set.\n");
+    switch ( schoku_init() ) {
+    case SCHOKU_NO_AVX2:
+        printf("This program requires a CPU with the %s instruction set.\n", SCHOKU_SIMD_NAME);
         exit(0);
-    }
-    // lacking BMI support? unlikely!
-    if ( !__builtin_cpu_supports("bmi") ) {
+    case SCHOKU_NO_BMI:
         printf("This program requires a CPU with the BMI instructions (such as blsr)\n");
         exit(0);
     }
 
-    bmi2_support = __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver2");
-
-    if ( debug ) {
-         omp_set_num_threads(1);
+    if ( opts.debug ) {
          printf("debug mode requires restriction of the number of threads to 1\n");
 
+#ifdef SCHOKU_SIMD_AVX2
          printf("BMI2 instructions %s %s\n",
                __builtin_cpu_supports("bmi2") ? "found" : "not found",
                bmi2_support? "and enabled" : __builtin_cpu_is("znver2")? "but use of pdep/pext instructions disabled":"");
+         printf("AVX-512BW/VL instructions %s %s\n",
+               avx512_support ? "found" : "not found",
+               avx512_support ? (opts.no_avx512 ? "but disabled" : "and enabled") : "");
+#else
+         printf("%s code path\n", SCHOKU_SIMD_NAME);
+#endif
+    }
+
+    if ( opts.interleave && opts.engine != SCHOKU_ENGINE_DIGITS ) {
+        // the cell-major solver (solve) cannot be suspended between steps
+        fprintf(stderr, "Error: -i requires the digit-major engine (-g1)\n");
+        exit(1);
+    }
+    if ( opts.parallel_search && (opts.engine != SCHOKU_ENGINE_CELLS || opts.trail || opts.debug
+                                  || opts.output_format == SCHOKU_OUTPUT_PACKED) ) {
+        // the branches are searched by the cell-major solver from copied states, and the solution
+        // of a branch is found after its solve returned
+        fprintf(stderr, "Error: -p requires the cell-major engine (-g0), not with -d, -f2 or -r\n");
+        exit(1);
     }
 
 	auto starttime = std::chrono::steady_clock::now();
 
-	const char *ifn = argc > 0? argv[0] : "puzzles.txt";
-	int fdin = open(ifn, O_RDONLY);
+    if ( generate ) {
+        // the first file name is the output file
+        const char *ofn = argc > 0 ? argv[0] : "stdout";
+        int fdout = argc > 0 ? open(ofn, O_WRONLY|O_CREAT|O_TRUNC, 0775) : 1;
+        if ( fdout == -1 ) {
+            if (errno ) {
+                printf("Error opening output file %s: %s\n", ofn, strerror(errno));
+                exit(0);
+            }
+        }
+        FILE *report = fdout == 1 ? stderr : stdout;
+        Stats stats;
+        signed char *out = (signed char *)malloc((size_t)generate*82);
+        if ( out == 0 ) {
+            fprintf(stderr, "Error allocating the %d puzzles to generate\n", generate);
+            exit(0);
+        }
+        long tries, clues;
+        unsigned long long seed = generate_seeded ? generate_seed : starttime.time_since_epoch().count();
+        size_t n = generate_puzzles(generate, generate_clues, generate_guesses, generate_symmetric, seed, opts, stats, out, tries, clues);
+        long long duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - starttime).count();
+        write_fully(fdout, out, n*82);
+        if ( fdout != 1 ) {
+            close(fdout);
+        }
+        fprintf(report, "%10ld  puzzles generated\n", n);
+        fprintf(report, "%10llu  seed\n", seed);
+        fprintf(report, "%8.1lfms  %6.2lf\u00b5s/puzzle  generation time\n", (double)duration/1000000, n ? (double)duration/(n*1000LL) : 0.0);
+        if ( n ) {
+            fprintf(report, "%10ld  %6.2f/puzzle  grids tried\n", tries, (double)tries/n);
+            fprintf(report, "%10ld  %6.2f/puzzle  clues\n", clues, (double)clues/n);
+            fprintf(report, "%10lld  %6.2f/puzzle  guesses\n", stats.guesses, (double)stats.guesses/n);
+        }
+        if ( n < (size_t)generate ) {
+            fprintf(report, "%10ld  puzzles not generated in %d tries each\n", generate-n, GENERATE_TRIES);
+        }
+        free(out);
+        return 0;
+    }
+
+	const char *ifn = argc > 0? argv[0] : streaming ? "stdin" : "puzzles.txt";
+	int fdin = server_addr || batch || (argc == 0 && streaming) ? 0 : open(ifn, O_RDONLY);
 	if ( fdin == -1 ) {
 		if (errno ) {
 			fprintf(stderr, "Error: Failed to open file %s: %s\n", ifn, strerror(errno));
@@ -2739,182 +6937,302 @@ int main(int argc, const char *argv[]) {
 	struct stat sb;
 	fstat(fdin, &sb);
     size_t fsize = sb.st_size;
+    size_t npuzzles = 0;
+    size_t failed_files = 0;    // the files skipped in batch mode
+    Stats stats;
+    FILE *report = stdout;
+
+    if ( !S_ISREG(sb.st_mode) ) {
+        // a pipe or the like cannot be mapped
+        streaming = 1;
+    }
 
-	// map the input file
-    signed char *string = (signed char *)mmap((void*)0, fsize, PROT_READ, MAP_PRIVATE, fdin, 0);
-	if ( string == MAP_FAILED ) {
-		if (errno ) {
-			printf("Error mmap of input file %s: %s\n", ifn, strerror(errno));
-			exit(0);
-		}
-	}
-	close(fdin);
-
-	// skip first line, unless it's a puzzle.
-    size_t pre = 0;
-    if ( !(isdigit((int)string[0]) || string[0] != '.' || string[81] != 10) ) {
-	    while (string[pre] != 10) {
-    	    ++pre;
-    	}
-    	++pre;
-	}
-    
-    size_t post = 1;
-	if ( string[fsize-1] != 10 )
-		post = 0;
-
-	// get and check the number of puzzles
-	size_t npuzzles = (fsize - pre + (1-post))/82;
-    size_t outnpuzzles = line_to_solve ? 1 : npuzzles;
-
-	if ( (fsize -pre -post + 1) % 82 ) {
-		fprintf(stderr, "found %ld puzzles with %ld(start)+%ld(end) extra characters\n", (fsize - pre - post + 1)/82, pre, post);
-	}
-
-	const char *ofn = argc > 1? argv[1] : "solutions.txt";
-	int fdout = open(ofn, O_RDWR|O_CREAT, 0775);
-	if ( fdout == -1 ) {
-		if (errno ) {
-			printf("Error opening output file %s: %s\n", ofn, strerror(errno));
-			exit(0);
+    if ( batch ) {
+        if ( iterations || line_to_solve || server_addr || verify_file_only || window_mb ) {
+            fprintf(stderr, "Error: the batch mode does not support -b, -l, -w, -V or -W\n");
+            exit(0);
+        }
+        if ( manifest == 0 && argc == 0 ) {
+            fprintf(stderr, "Error: the batch mode requires a manifest (-Mmanifest) or input file names\n");
+            exit(1);
+        }
+        npuzzles = solve_files(manifest, argc, argv, opts, stats, failed_files);
+    } else if ( verify_file_only ) {
+        if ( !S_ISREG(sb.st_mode) ) {
+            fprintf(stderr, "Error: -V requires a regular file\n");
+            exit(0);
+        }
+        signed char *string = fsize ? (signed char *)mmap((void*)0, fsize, PROT_READ, MAP_PRIVATE, fdin, 0) : 0;
+        if ( string == MAP_FAILED ) {
+            if (errno ) {
+                printf("Error mmap of input file %s: %s\n", ifn, strerror(errno));
+                exit(0);
+            }
+        }
+        close(fdin);
+        size_t failed = verify_file(string, fsize, opts, report);
+        if ( fsize ) {
+            munmap(string, fsize);
+        }
+        // for scripts: the exit status is 1 if any record failed
+        return failed ? 1 : 0;
+    } else if ( server_addr ) {
+        if ( opts.output_format == SCHOKU_OUTPUT_PACKED || iterations ) {
+            fprintf(stderr, "Error: the server mode does not support -f2 or -b\n");
+            exit(0);
+        }
+        if ( *server_addr == 0 ) {
+            // keep the responses clean
+            report = stderr;
+        }
+        npuzzles = serve(server_addr, opts, stats);
+    } else if ( streaming && iterations ) {
+        fprintf(stderr, "Error: benchmark mode requires an input file\n");
+        exit(0);
+    } else if ( streaming ) {
+        bool to_stdout = argc < 2 || strcmp(argv[1], "-") == 0;
+        const char *ofn = to_stdout ? "stdout" : argv[1];
+        int fdout;
+        if ( to_stdout ) {
+            // keep the solutions clean, the messages of the solver go to stderr
+            fdout = dup(1);
+            dup2(2, 1);
+            report = stderr;
+        } else {
+            fdout = open(ofn, O_WRONLY|O_CREAT|O_TRUNC, 0775);
+        }
+        if ( fdout == -1 ) {
+            if (errno ) {
+                printf("Error opening output file %s: %s\n", ofn, strerror(errno));
+                exit(0);
+            }
+        }
+        npuzzles = solve_stream(fdin, fdout, opts, stats, line_to_solve);
+        close(fdin);
+        close(fdout);
+    } else {
+		// map the input file
+        signed char *string = (signed char *)mmap((void*)0, fsize, PROT_READ, MAP_PRIVATE, fdin, 0);
+		if ( string == MAP_FAILED ) {
+			if (errno ) {
+				printf("Error mmap of input file %s: %s\n", ifn, strerror(errno));
+				exit(0);
+			}
 		}
-	}
-    if ( ftruncate(fdout, (size_t)outnpuzzles*164) == -1 ) {
-		if (errno ) {
-			printf("Error setting size (ftruncate) on output file %s: %s\n", ofn, strerror(errno));
+		close(fdin);
+
+		// find the puzzles, a header line (shorter than a puzzle) or comments are skipped
+        size_t skipped = 0;
+        std::vector<size_t> index = index_puzzles(string, fsize, npuzzles, skipped);
+        const size_t *pindex = index.empty() ? 0 : index.data();
+		if ( skipped ) {
+			fprintf(stderr, "found %ld puzzles, skipped %ld lines with less than 81 characters\n", npuzzles, skipped);
 		}
-		exit(0);
-	}
-
-	// map the output file
-    output = (signed char *)mmap((void*)0, outnpuzzles*164, PROT_WRITE, MAP_SHARED, fdout, 0);
-	if ( output == MAP_FAILED ) {
-		if (errno ) {
-			printf("Error mmap of output file %s: %s\n", ofn, strerror(errno));
-			exit(0);
+        if ( line_to_solve > (int)npuzzles ) {
+            fprintf(stderr, "Error: line %d is beyond the %ld puzzles\n", line_to_solve, npuzzles);
+            exit(0);
+        }
+        size_t outnpuzzles = line_to_solve ? 1 : npuzzles;
+        size_t rsize = schoku_record_size(opts.output_format);
+
+		const char *ofn = argc > 1? argv[1] : "solutions.txt";
+        // stdout ('-'), a pipe or a device cannot be mapped, the solutions are written in order
+        struct stat ostat;
+        bool ordered = strcmp(ofn, "-") == 0 || (stat(ofn, &ostat) == 0 && !S_ISREG(ostat.st_mode));
+        if ( ordered && opts.parallel_search ) {
+            // the solutions of a chunk are written when its solve calls return
+            fprintf(stderr, "Error: -p is not supported with output to stdout or a pipe (use -s)\n");
+            exit(1);
+        }
+        int fdout;
+        if ( strcmp(ofn, "-") == 0 ) {
+            // keep the solutions clean
+            fdout = dup(1);
+            dup2(2, 1);
+            report = stderr;
+        } else {
+		    fdout = open(ofn, ordered ? O_WRONLY : O_RDWR|O_CREAT, 0775);
+        }
+		if ( fdout == -1 ) {
+			if (errno ) {
+				printf("Error opening output file %s: %s\n", ofn, strerror(errno));
+				exit(0);
+			}
 		}
-	}
-	close(fdout);
-
-    // solve all sudokus and prepare output file
-    size_t i;
-    size_t imax = npuzzles*82;
-
-    signed char *string_pre = string+pre;
-	GridState *stack = 0;
-
-    if ( line_to_solve ) {
-        i = (line_to_solve-1)*82;
-        // copy unsolved grid
-        memcpy(output, &string_pre[i], 81);
-        memcpy(&output[82], &string_pre[i], 81);
-        // add comma and newline in right place
-        output[81] = ',';
-        output[163] = 10;
-        // solve the grid in place
-        if ( stack == 0 ) {
-            // force alignment the 'old-fashioned' way
-            // stack = (GridState*)malloc(sizeof(GridState)*GRIDSTATE_MAX);
-            stack = (GridState*) (~0x3fll & ((unsigned long long) malloc(sizeof(GridState)*GRIDSTATE_MAX+0x40)+0x40));
+        if ( ordered && iterations ) {
+            fprintf(stderr, "Error: benchmark mode requires a regular output file\n");
+            exit(0);
         }
-
-        signed char *grid = &output[82];
-
-        stack[0].initialize(grid);
-
-        if ( reportstats !=0 || debug != 0) {
-            solve<true>(grid, stack, line_to_solve);
+        // the windowed output, for the file of all the puzzles
+        bool windowed = window_mb && !ordered && !iterations && !line_to_solve;
+        // the NUMA mode that solve_batch takes (not on a single node)
+        bool numa = numa_mode(opts);
+
+        signed char *output = 0;
+        OrderedOutput *sink = 0;
+        if ( ordered ) {
+            sink = new OrderedOutput(fdout, rsize);
+        } else if ( windowed ) {
+            if ( (numa && ftruncate(fdout, 0) == -1) || ftruncate(fdout, outnpuzzles*rsize) == -1 ) {
+			    if (errno ) {
+				    printf("Error setting size (ftruncate) on output file %s: %s\n", ofn, strerror(errno));
+			    }
+			    exit(0);
+		    }
         } else {
-            solve<false>(grid, stack, line_to_solve);
+            // NUMA mode: drop the pages of a previous output, the pages are placed by the first touch of the solving threads
+            if ( (numa && ftruncate(fdout, 0) == -1) || ftruncate(fdout, outnpuzzles*rsize) == -1 ) {
+			    if (errno ) {
+				    printf("Error setting size (ftruncate) on output file %s: %s\n", ofn, strerror(errno));
+			    }
+			    exit(0);
+		    }
+
+		    // map the output file
+            output = (signed char *)mmap((void*)0, outnpuzzles*rsize, PROT_WRITE, MAP_SHARED, fdout, 0);
+		    if ( output == MAP_FAILED ) {
+			    if (errno ) {
+				    printf("Error mmap of output file %s: %s\n", ofn, strerror(errno));
+				    exit(0);
+			    }
+		    }
+		    close(fdout);
         }
-    } else {
 
-        // The OMP directives:
-        // proc_bind(close): high preferance for thread/core affinity
-        // firstprivate(stack): the stack is allocated for each thread once and seperately
-        // schedule(dynamic,64): 64 puzzles are allocated at a time and these chunks
-        //   are assigned dynmically (to minimize random effects of difficult puzzles)
-        // shared(...) lists the variables that are shared (as opposed to separate copies per thread)
-        //
-#pragma omp parallel for proc_bind(close) firstprivate(stack) shared(string_pre, output, npuzzles, i, imax, debug, reportstats) schedule(dynamic,64)
-        for (i = 0; i < imax; i+=82) {
-            // copy unsolved grid
-            signed char *grid = &output[i*2+82];
-            memcpy(&output[i*2], &string_pre[i], 81);
-            memcpy(grid, &string_pre[i], 81);
-            // add comma and newline in right place
-            output[i*2 + 81] = ',';
-            output[i*2 + 163] = 10;
-            // solve the grid in place
-            if ( stack == 0 ) {
-                // force alignment the 'old-fashioned' way
-                // not going to free the data ever
-                // stack = (GridState*)malloc(sizeof(GridState)*GRIDSTATE_MAX);
-                stack = (GridState*) (~0x3fll & ((unsigned long long) malloc(sizeof(GridState)*GRIDSTATE_MAX+0x40)+0x40));
-            }
-
-            stack[0].initialize(&output[i*2+82]);
-            if ( reportstats !=0 || debug != 0) {
-                solve<true>(grid, stack, i/82+1);
+        // solve all sudokus and prepare output file
+        signed char *puzzle_to_solve = 0;
+        if ( line_to_solve ) {
+            puzzle_to_solve = string + (pindex ? pindex[line_to_solve-1] : (line_to_solve-1)*82);
+        }
+
+        if ( iterations ) {
+            if ( line_to_solve ) {
+                run_benchmark(puzzle_to_solve, 1, 0, output, opts, stats, line_to_solve, iterations, warmups, starttime, report);
             } else {
-                solve<false>(grid, stack, i/82+1);
+                run_benchmark(string, npuzzles, pindex, output, opts, stats, 1, iterations, warmups, starttime, report);
             }
+        } else if ( line_to_solve ) {
+            solve_batch(puzzle_to_solve, 1, output, opts, stats, line_to_solve, 0, 0, sink);
+        } else if ( windowed ) {
+            solve_windowed(string, npuzzles, pindex, string, fdout, ofn, window_mb, opts, stats);
+        } else {
+            solve_batch(string, npuzzles, output, opts, stats, 1, 0, pindex, sink);
         }
-    }
 
-	int err = munmap(string, fsize);
-	if ( err == -1 ) {
-		if (errno ) {
-			printf("Error munmap file %s: %s\n", ifn, strerror(errno));
-		}
-	}
-	err = munmap(output, (size_t)npuzzles*164);
-	if ( err == -1 ) {
-		if (errno ) {
-			printf("Error munmap file %s: %s\n", ofn, strerror(errno));
+		int err = munmap(string, fsize);
+		if ( err == -1 ) {
+			if (errno ) {
+				printf("Error munmap file %s: %s\n", ifn, strerror(errno));
+			}
 		}
-	}
+        if ( sink ) {
+            delete sink;
+            close(fdout);
+        } else if ( windowed ) {
+            close(fdout);
+        } else {
+		    err = munmap(output, outnpuzzles*rsize);
+		    if ( err == -1 ) {
+			    if (errno ) {
+				    printf("Error munmap file %s: %s\n", ofn, strerror(errno));
+			    }
+		    }
+        }
+    }
+
+    schoku_stats st;
+    stats.copy_to(&st);
 
-    if ( reportstats) {
+    if ( opts.reportstats) {
         long long duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration(std::chrono::steady_clock::now() - starttime)).count();
-        printf("schoku version: %s\ncompile options: %s\n", version_string, compilation_options);
-        printf("%10ld  puzzles entered\n", npuzzles);
-        printf("%10ld  %.0lf/s  puzzles solved\n", solved_count.load(), (double)solved_count.load()/((double)duration/1000000000LL));
-		printf("%8.1lfms  %6.2lf\u00b5s/puzzle  solving time\n", (double)duration/1000000, (double)duration/(npuzzles*1000LL));
-        if ( unsolved_count.load()) {
-            printf("%10ld  puzzles had no solution\n", unsolved_count.load());
+        fprintf(report, "schoku version: %s\ncompile options: %s\n", version_string, compilation_options);
+        if ( opts.strategies ) {
+            const char *strategy_names[STRATEGY_COMBINATIONS] = {
+                "no triad resolution, naked sets or fish", "triad resolution", "naked sets", "triad resolution and naked sets",
+                "fish", "triad resolution and fish", "naked sets and fish", "triad resolution, naked sets and fish" };
+            for (int s = 0; s < STRATEGY_COMBINATIONS; s++) {
+                if ( stats.strategy_count[s] ) {
+                    fprintf(report, "%10ld  puzzles solved with %s\n", stats.strategy_count[s], strategy_names[s]);
+                }
+            }
         }
-        if ( unique_check ) {
-            printf("%10ld  puzzles had a unique solution\n", solved_count.load() - non_unique_count.load());
+        fprintf(report, "%10ld  puzzles entered\n", npuzzles);
+        fprintf(report, "%10ld  %.0lf/s  puzzles solved\n", st.solved_count, (double)st.solved_count/((double)duration/1000000000LL));
+		fprintf(report, "%8.1lfms  %6.2lf\u00b5s/puzzle  solving time\n", (double)duration/1000000, (double)duration/(npuzzles*1000LL));
+        if ( st.unsolved_count) {
+            fprintf(report, "%10ld  puzzles had no solution\n", st.unsolved_count);
         }
-        if ( verify ) {
-            printf("%10ld  puzzle solutions were verified\n", verified_count.load());
-        }
-        printf( "%10ld  %6.2f%%  puzzles solved without guessing\n", no_guess_cnt.load(), (double)no_guess_cnt.load()/(double)solved_count.load()*100);
-        printf("%10lld  %6.2f/puzzle  guesses\n", guesses.load(), (double)guesses.load()/(double)solved_count.load());
-        printf("%10lld  %6.2f/puzzle  back tracks\n", trackbacks.load(), (double)trackbacks.load()/(double)solved_count.load());
-        printf("%10lld  %6.2f/puzzle  digits entered and retracted\n", digits_entered_and_retracted.load(), (double)digits_entered_and_retracted.load()/(double)solved_count.load());
-        printf("%10lld  %6.2f/puzzle  'rounds'\n", past_naked_count.load(), (double)past_naked_count.load()/(double)solved_count.load());
-        printf( "%10ld  %6.2f/puzzle  triads resolved\n", triads_resolved.load(), triads_resolved.load()/(double)solved_count.load());
-        printf( "%10ld  %6.2f/puzzle  triad updates\n", triad_updates.load(), triad_updates.load()/(double)solved_count.load());
-#ifdef OPT_SETS
-        printf("%10lld  %6.2f/puzzle  naked sets found\n", naked_sets_found.load(), naked_sets_found.load()/(double)solved_count.load());
-        printf("%10lld  %6.2f/puzzle  naked sets searched\n", naked_sets_searched.load(), naked_sets_searched.load()/(double)solved_count.load());
-#endif
-        if ( bug_count.load() ) {
-            printf("%10ld  bi-value universal graves detected\n", bug_count.load());
+        if ( opts.unique_check ) {
+            fprintf(report, "%10ld  puzzles had a unique solution\n", st.solved_count - st.non_unique_count);
+        }
+        if ( opts.verify ) {
+            fprintf(report, "%10ld  puzzle solutions were verified\n", st.verified_count);
+        }
+        if ( opts.cache_size ) {
+            fprintf(report, "%10ld  puzzles solved from the cache\n", st.cache_hits);
+        }
+        fprintf(report, "%10ld  %6.2f%%  puzzles solved without guessing\n", st.no_guess_cnt, (double)st.no_guess_cnt/(double)st.solved_count*100);
+        fprintf(report, "%10lld  %6.2f/puzzle  guesses\n", st.guesses, (double)st.guesses/(double)st.solved_count);
+        fprintf(report, "%10lld  %6.2f/puzzle  back tracks\n", st.trackbacks, (double)st.trackbacks/(double)st.solved_count);
+        fprintf(report, "%10lld  %6.2f/puzzle  digits entered and retracted\n", st.digits_entered_and_retracted, (double)st.digits_entered_and_retracted/(double)st.solved_count);
+        fprintf(report, "%10lld  %6.2f/puzzle  'rounds'\n", st.past_naked_count, (double)st.past_naked_count/(double)st.solved_count);
+        fprintf(report, "%10ld  %6.2f/puzzle  triads resolved\n", st.triads_resolved, st.triads_resolved/(double)st.solved_count);
+        fprintf(report, "%10ld  %6.2f/puzzle  triad updates\n", st.triad_updates, st.triad_updates/(double)st.solved_count);
+        // the puzzles solved with the naked sets search and with the fish search
+        long with_sets = 0;
+        long with_fish = 0;
+        for (int s = 0; s < STRATEGY_COMBINATIONS; s++) {
+            with_sets += (s & SCHOKU_STRATEGY_SETS) ? stats.strategy_count[s] : 0;
+            with_fish += (s & SCHOKU_STRATEGY_FISH) ? stats.strategy_count[s] : 0;
+        }
+        if ( with_sets ) {
+            fprintf(report, "%10lld  %6.2f/puzzle  naked sets found\n", st.naked_sets_found, st.naked_sets_found/(double)st.solved_count);
+            fprintf(report, "%10lld  %6.2f/puzzle  naked sets searched\n", st.naked_sets_searched, st.naked_sets_searched/(double)st.solved_count);
+        }
+        if ( with_fish ) {
+            fprintf(report, "%10ld  %6.2f/puzzle  x-wings and swordfish found\n", st.fish_found, st.fish_found/(double)st.solved_count);
+            fprintf(report, "%10ld  %6.2f/puzzle  candidates removed by fish\n", st.fish_removed, st.fish_removed/(double)st.solved_count);
         }
+        if ( opts.probe ) {
+            fprintf(report, "%10ld  %6.2f/puzzle  guesses probed\n", st.probes, st.probes/(double)st.solved_count);
+            fprintf(report, "%10ld  %6.2f/puzzle  candidates removed by probing\n", st.probe_removed, st.probe_removed/(double)st.solved_count);
+        }
+        if ( st.bug_count ) {
+            fprintf(report, "%10ld  bi-value universal graves detected\n", st.bug_count);
+        }
+        if ( opts.schedule == SCHOKU_SCHEDULE_STEAL ) {
+            fprintf(report, "%10ld  ranges stolen\n", st.steals);
+        }
+#ifdef OPT_PHASE_STATS
+        fprintf(report, "phase              calls   progress  no progress  back track   Mcycles  cycles/call\n");
+        for (int p = 0; p < Phases; p++) {
+            const unsigned long long *calls = stats.phases.calls[p];
+            unsigned long long total = calls[PhaseProgress] + calls[PhaseNoProgress] + calls[PhaseBack];
+            fprintf(report, "%-14s %10lld %10lld   %10lld  %10lld  %8.1lf  %11.1lf\n", phase_names[p], total,
+                    calls[PhaseProgress], calls[PhaseNoProgress], calls[PhaseBack],
+                    stats.phases.cycles[p]/1000000.0, total ? (double)stats.phases.cycles[p]/total : 0.0);
+        }
+#endif
     }
 
-    if ( unique_check && non_unique_count.load()) {
-        printf("%10ld  puzzles had more than one solution\n", non_unique_count.load());
+    if ( opts.unique_check && st.non_unique_count) {
+        fprintf(report, "%10ld  puzzles had more than one solution\n", st.non_unique_count);
+    }
+    if ( opts.solution_limit && st.limit_count ) {
+        fprintf(report, "%10ld  puzzles had %d or more solutions\n", st.limit_count, solution_limit(opts));
     }
-    if ( verify && not_verified_count.load()) {
-        printf("%10ld  puzzle solutions verified as not correct\n", not_verified_count.load());
+    if ( opts.verify && st.not_verified_count) {
+        fprintf(report, "%10ld  puzzle solutions verified as not correct\n", st.not_verified_count);
     }
-    if ( !reportstats && unsolved_count.load()) {
-        printf("%10ld puzzles had no solution\n", unsolved_count.load());
+    if ( !opts.reportstats && st.unsolved_count) {
+        fprintf(report, "%10ld puzzles had no solution\n", st.unsolved_count);
+    }
+    if ( failed_files ) {
+        fprintf(stderr, "%10ld  files skipped\n", failed_files);
+        return 1;
     }
 
     return 0;
 }
+
+#endif // SCHOKU_LIBRARY
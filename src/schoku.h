@@ -0,0 +1,175 @@
+/*
+ * Schoku
+ *
+ * A high speed sudoku solver by M. Schulz
+ *
+ * schoku.h: the library interface (libschoku)
+ *
+ * The solver can be linked into another program to solve batches of puzzles
+ * without the startup cost of a process per batch.
+ * All state of a batch is kept per call; the per-thread GridState stacks and
+ * the OMP thread team are kept warm between calls.
+ *
+ * Usage:
+ *     schoku_init() once per process, then any number of schoku_solve_batch() calls.
+ */
+#ifndef SCHOKU_H
+#define SCHOKU_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// schoku_opts
+// options for one call of schoku_solve_batch, these correspond to the command line options.
+//
+typedef struct schoku_opts {
+    int reportstats;     // collect some statistics
+    int verify;          // verify solution correctness (implied otherwise)
+    int unique_check;    // check solution uniqueness
+    int debug;           // provide step by step output on the solution (forces a single thread)
+    int thorough_check;  // check for back tracking even if no guess was made.
+    int numthreads;      // if not 0, number of threads
+    int no_avx512;       // use the AVX2 code path even if AVX-512 is available
+    int output_format;   // one of the SCHOKU_OUTPUT_* formats below
+    int trail;           // back track with a trail of saved states instead of GridState copies
+    int parallel_search; // idle threads search branches of the puzzles of other threads, only with
+                         // SCHOKU_ENGINE_CELLS, ignored with trail, debug or SCHOKU_OUTPUT_PACKED
+    int schedule;        // one of the SCHOKU_SCHEDULE_* schedules below
+    int cache_size;      // if not 0, entries of the solution cache (see below)
+    int strategies;      // the SCHOKU_STRATEGY_* below, 0 for the default strategies
+    int numa;            // split the puzzles by NUMA node, each solved by threads bound to the node
+    int engine;          // one of the SCHOKU_ENGINE_* engines below
+    int probe;           // if not 0, probe the candidates of this many bi-value cells before a guess
+    int solution_limit;  // with unique_check, if not 0, count the solutions of each puzzle up to this many
+                         // and report the count of each puzzle (the default limit is 2, without report)
+    int interleave;      // if > 1, each thread advances this many puzzles (up to 4) in turn,
+                         // only with SCHOKU_ENGINE_DIGITS
+} schoku_opts;
+
+// schedules of the puzzles to the threads
+// SCHOKU_SCHEDULE_DYNAMIC: in input order, in chunks of 64 puzzles
+// SCHOKU_SCHEDULE_GUIDED: in input order, in chunks that get smaller as the batch drains
+// SCHOKU_SCHEDULE_HARDEST_FIRST: the puzzles with the fewest clues first (a pre-pass counts the clues)
+// SCHOKU_SCHEDULE_STEAL: in input order, a contiguous range per thread that starts and ends at
+//     a page of the output, idle threads steal half of the largest remaining range of another.
+//     Not with interleave, which uses the dynamic schedule.
+// The solutions are always output in input order.
+// With numa, the puzzles are split into a contiguous range per NUMA node, the threads of a node
+// solve the puzzles of its range in chunks of 64 in input order, then help the other nodes.
+// The schedule is not used then.  There is no NUMA mode on a machine with a single node.
+//
+#define SCHOKU_SCHEDULE_DYNAMIC       0
+#define SCHOKU_SCHEDULE_GUIDED        1
+#define SCHOKU_SCHEDULE_HARDEST_FIRST 2
+#define SCHOKU_SCHEDULE_STEAL         3
+
+// strategies
+// The strategies that are tried before a guess is made, besides the naked and hidden singles
+// and the triads:
+// SCHOKU_STRATEGY_TRIAD_RES: resolve triads with exactly 3 candidates (OPT_TRIAD_RES)
+// SCHOKU_STRATEGY_SETS: search for naked sets (OPT_SETS)
+// SCHOKU_STRATEGY_FISH: search for X-Wings and Swordfish (OPT_FISH)
+// These are used with SCHOKU_STRATEGY_SELECTED.  Otherwise, the default strategies
+// are those given at compile time (OPT_TRIAD_RES, OPT_SETS, OPT_FISH).
+// SCHOKU_STRATEGY_AUTO: sample the first few thousand puzzles of a batch with each
+//     combination and use the fastest for the rest.
+//
+#define SCHOKU_STRATEGY_TRIAD_RES 1
+#define SCHOKU_STRATEGY_SETS      2
+#define SCHOKU_STRATEGY_FISH      4
+#define SCHOKU_STRATEGY_SELECTED  8
+#define SCHOKU_STRATEGY_AUTO      16
+
+// engines
+// SCHOKU_ENGINE_CELLS: the candidates of each cell (cell-major), with the strategies below
+// SCHOKU_ENGINE_DIGITS: the cells of each digit (digit-major), 9 planes of 3 27-bit band words;
+//     naked and hidden singles and guesses
+// SCHOKU_ENGINE_HYBRID: cell-major until the first guess, then the digit-major search
+// The strategies and parallel_search are only used by the cell-major engine.
+//
+#define SCHOKU_ENGINE_CELLS  0
+#define SCHOKU_ENGINE_DIGITS 1
+#define SCHOKU_ENGINE_HYBRID 2
+
+// the solution cache
+// Puzzles that are the same up to relabeling the digits and the permutations of rows,
+// columns, bands and stacks and transposition that keep a sudoku valid are solved once.
+// The cache is shared by all calls of a process and is never cleared,
+// its size is set by the first call with a cache_size.
+// Not used with parallel_search, debug or solution_limit.
+//
+// output formats
+// SCHOKU_OUTPUT_FULL: the puzzle, a comma, the solution and a newline (164 bytes)
+// SCHOKU_OUTPUT_SOLUTION: the solution and a newline (82 bytes)
+// SCHOKU_OUTPUT_PACKED: the solution with 4 bits per cell, the first cell of a pair
+//     in the high nibble, 0 for a cell without a digit (41 bytes, the last low nibble is 0)
+//
+#define SCHOKU_OUTPUT_FULL     0
+#define SCHOKU_OUTPUT_SOLUTION 1
+#define SCHOKU_OUTPUT_PACKED   2
+
+// schoku_record_size
+// the size of an output record in the given format.
+//
+size_t schoku_record_size(int output_format);
+
+// schoku_stats
+// statistics of one call of schoku_solve_batch.
+// Apart from unsolved_count, non_unique_count and not_verified_count,
+// the counts are only collected with reportstats.
+//
+typedef struct schoku_stats {
+    long solved_count;                      // puzzles solved
+    long unsolved_count;                    // puzzles unsolved (no solution exists)
+    long non_unique_count;                  // puzzles not unique (with unique_check)
+    long not_verified_count;                // puzzles non verified (with verify)
+    long verified_count;                    // puzzles successfully verified (with verify)
+    long bug_count;                         // universal grave detected
+    long long guesses;                      // how many guesses did it take
+    long long trackbacks;                   // how often did we back track
+    long no_guess_cnt;                      // how many puzzles were solved without guessing
+    long long past_naked_count;             // how often do we get past the naked single serach
+    long long naked_sets_searched;          // how many naked sets did we search for
+    long long naked_sets_found;             // how many naked sets did we actually find
+    long long digits_entered_and_retracted; // to measure guessing overhead
+    long triads_resolved;                   // how many triads did we resolved
+    long triad_updates;                     // how many triads did cancel candidates
+    long cache_hits;                        // puzzles solved from the solution cache
+    long fish_found;                        // X-Wings and Swordfish that removed candidates
+    long fish_removed;                      // candidates removed by them
+    long probes;                            // candidates probed before a guess (with probe)
+    long probe_removed;                     // probed candidates that failed and were removed
+    long limit_count;                       // puzzles with at least solution_limit solutions
+    long steals;                            // ranges stolen by idle threads (SCHOKU_SCHEDULE_STEAL)
+} schoku_stats;
+
+// schoku_init
+// check the CPU capabilities and set up the solver.
+// returns 0 on success, SCHOKU_NO_AVX2 or SCHOKU_NO_BMI if the CPU is not supported.
+// SCHOKU_NO_AVX2 means the vector instructions of the build (see simd.h),
+// i.e. SSE4.1 and POPCNT with the SSE4.1 backend.
+// Safe to call more than once.
+//
+#define SCHOKU_NO_AVX2 1
+#define SCHOKU_NO_BMI  2
+int schoku_init(void);
+
+// schoku_solve_batch
+// solve n puzzles.
+// in:  n puzzles of 81 characters each, at a stride of 82 (i.e. one puzzle per line).
+// out: n records of schoku_record_size(opts->output_format) bytes each,
+//      by default the puzzle, a comma, the solution and a newline (164 bytes).
+// opts:  the options for this batch, 0 for the defaults.
+// stats: if not 0, receives the statistics of this batch.
+// Returns the number of puzzles that had a solution.
+//
+size_t schoku_solve_batch(const char *in, size_t n, char *out, const schoku_opts *opts, schoku_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCHOKU_H
@@ -0,0 +1,389 @@
+/*
+ * Schoku
+ *
+ * A high speed sudoku solver by M. Schulz
+ *
+ * simd.h: the vector operations of the solver, by build target
+ *
+ * The solver is written with the AVX2 (and BMI1/BMI2) intrinsics.
+ * The backend is chosen at build time (see SIMD in the Makefile):
+ * SCHOKU_SIMD_AVX2:  x86-64 with AVX2, BMI1 and BMI2 (-mavx2 -mbmi -mbmi2 -mlzcnt), the intrinsics as is.
+ *                    The AVX-512 code path is only available with this backend.
+ * SCHOKU_SIMD_SSE41: x86-64 with SSE4.1 and POPCNT (-msse4.1 -mpopcnt)
+ * SCHOKU_SIMD_NEON:  AArch64 (Advanced SIMD is always there)
+ * The latter two provide the AVX2 intrinsics used by the solver on pairs of 128-bit vectors,
+ * the low and the high lane of the 256-bit vector.  Most AVX2 instructions work on the
+ * two lanes separately anyway.  The NEON backend first provides the SSE intrinsics used
+ * on top of the Advanced SIMD intrinsics.
+ * The bit manipulation instructions (tzcnt, blsr, pext etc.) are replaced by the GCC builtins
+ * (pdep/pext by a loop, the solver does not use them with these backends, see get_solver).
+ * As the operations are the same, the solver makes the same choices and gathers the same
+ * statistics with either backend.
+ */
+#ifndef SCHOKU_SIMD_H
+#define SCHOKU_SIMD_H
+
+#if defined(__AVX2__)
+#define SCHOKU_SIMD_AVX2 1
+#define SCHOKU_SIMD_NAME "AVX2"
+#elif defined(__SSE4_1__)
+#define SCHOKU_SIMD_SSE41 1
+#define SCHOKU_SIMD_NAME "SSE4.1"
+#elif defined(__aarch64__)
+#define SCHOKU_SIMD_NEON 1
+#define SCHOKU_SIMD_NAME "NEON"
+#else
+#error "schoku requires AVX2 or SSE4.1 (x86-64) or Advanced SIMD (AArch64)"
+#endif
+
+#ifdef SCHOKU_SIMD_AVX2
+
+#include <intrin.h>
+
+#else
+
+#include <string.h>
+
+#ifdef SCHOKU_SIMD_SSE41
+// no <immintrin.h>: the AVX types and intrinsics are defined below
+#include <smmintrin.h>
+#endif
+
+#ifdef SCHOKU_SIMD_NEON
+#include <arm_neon.h>
+
+// the SSE intrinsics used by the solver and by the 256-bit vectors below.
+// NEON and SSE vectors are GCC vector types, an explicit cast reinterprets the bytes.
+typedef int64x2_t __m128i __attribute__((may_alias));
+typedef int64x2_t __m128i_u __attribute__((may_alias, aligned(1)));
+typedef unsigned short __v8hu __attribute__((vector_size(16)));
+
+inline __attribute__((always_inline)) __m128i _mm_setzero_si128() {
+    return vdupq_n_s64(0);
+}
+inline __attribute__((always_inline)) __m128i _mm_load_si128(const __m128i *p) {
+    return vld1q_s64((const int64_t *)p);
+}
+inline __attribute__((always_inline)) __m128i _mm_loadu_si128(const __m128i *p) {
+    return (__m128i)vld1q_u8((const uint8_t *)p);
+}
+inline __attribute__((always_inline)) void _mm_store_si128(__m128i *p, __m128i a) {
+    vst1q_s64((int64_t *)p, a);
+}
+inline __attribute__((always_inline)) void _mm_storeu_si128(__m128i *p, __m128i a) {
+    vst1q_u8((uint8_t *)p, (uint8x16_t)a);
+}
+inline __attribute__((always_inline)) void _mm_storeu_si64(void *p, __m128i a) {
+    vst1_u8((uint8_t *)p, vget_low_u8((uint8x16_t)a));
+}
+inline __attribute__((always_inline)) __m128i _mm_set1_epi8(char b) {
+    return (__m128i)vdupq_n_s8(b);
+}
+inline __attribute__((always_inline)) __m128i _mm_set1_epi16(short w) {
+    return (__m128i)vdupq_n_s16(w);
+}
+inline __attribute__((always_inline)) __m128i _mm_setr_epi8(char b0, char b1, char b2, char b3, char b4, char b5, char b6, char b7,
+                                                          char b8, char b9, char b10, char b11, char b12, char b13, char b14, char b15) {
+    return (__m128i)(int8x16_t){ b0, b1, b2, b3, b4, b5, b6, b7, b8, b9, b10, b11, b12, b13, b14, b15 };
+}
+inline __attribute__((always_inline)) __m128i _mm_setr_epi16(short w0, short w1, short w2, short w3, short w4, short w5, short w6, short w7) {
+    return (__m128i)(int16x8_t){ w0, w1, w2, w3, w4, w5, w6, w7 };
+}
+inline __attribute__((always_inline)) __m128i _mm_set_epi16(short w7, short w6, short w5, short w4, short w3, short w2, short w1, short w0) {
+    return (__m128i)(int16x8_t){ w0, w1, w2, w3, w4, w5, w6, w7 };
+}
+inline __attribute__((always_inline)) __m128i _mm_and_si128(__m128i a, __m128i b) {
+    return vandq_s64(a, b);
+}
+inline __attribute__((always_inline)) __m128i _mm_or_si128(__m128i a, __m128i b) {
+    return vorrq_s64(a, b);
+}
+inline __attribute__((always_inline)) __m128i _mm_xor_si128(__m128i a, __m128i b) {
+    return veorq_s64(a, b);
+}
+// ~a & b
+inline __attribute__((always_inline)) __m128i _mm_andnot_si128(__m128i a, __m128i b) {
+    return vbicq_s64(b, a);
+}
+inline __attribute__((always_inline)) __m128i _mm_cmpeq_epi8(__m128i a, __m128i b) {
+    return (__m128i)vceqq_s8((int8x16_t)a, (int8x16_t)b);
+}
+inline __attribute__((always_inline)) __m128i _mm_cmpgt_epi8(__m128i a, __m128i b) {
+    return (__m128i)vcgtq_s8((int8x16_t)a, (int8x16_t)b);
+}
+inline __attribute__((always_inline)) __m128i _mm_cmpeq_epi16(__m128i a, __m128i b) {
+    return (__m128i)vceqq_s16((int16x8_t)a, (int16x8_t)b);
+}
+inline __attribute__((always_inline)) __m128i _mm_cmpgt_epi16(__m128i a, __m128i b) {
+    return (__m128i)vcgtq_s16((int16x8_t)a, (int16x8_t)b);
+}
+inline __attribute__((always_inline)) __m128i _mm_add_epi8(__m128i a, __m128i b) {
+    return (__m128i)vaddq_s8((int8x16_t)a, (int8x16_t)b);
+}
+inline __attribute__((always_inline)) __m128i _mm_sub_epi16(__m128i a, __m128i b) {
+    return (__m128i)vsubq_s16((int16x8_t)a, (int16x8_t)b);
+}
+inline __attribute__((always_inline)) __m128i _mm_srli_epi16(__m128i a, int n) {
+    return (__m128i)vshlq_u16((uint16x8_t)a, vdupq_n_s16(-n));
+}
+// the byte shifts and the lane accesses take immediates
+#define _mm_srli_si128(a, n) ((__m128i)vextq_u8((uint8x16_t)(a), vdupq_n_u8(0), (n)))
+#define _mm_alignr_epi8(a, b, n) ((__m128i)vextq_u8((uint8x16_t)(b), (uint8x16_t)(a), (n)))
+#define _mm_extract_epi16(a, i) ((int)vgetq_lane_u16((uint16x8_t)(a), (i)))
+#define _mm_extract_epi64(a, i) ((long long)vgetq_lane_s64((a), (i)))
+#define _mm_insert_epi16(a, w, i) ((__m128i)vsetq_lane_s16((w), (int16x8_t)(a), (i)))
+// tbl yields 0 for an index beyond the table, as pshufb does with the top bit set
+inline __attribute__((always_inline)) __m128i _mm_shuffle_epi8(__m128i a, __m128i b) {
+    return (__m128i)vqtbl1q_u8((uint8x16_t)a, vandq_u8((uint8x16_t)b, vdupq_n_u8(0x8f)));
+}
+inline __attribute__((always_inline)) __m128i _mm_packs_epi16(__m128i a, __m128i b) {
+    return (__m128i)vcombine_s8(vqmovn_s16((int16x8_t)a), vqmovn_s16((int16x8_t)b));
+}
+inline __attribute__((always_inline)) __m128i _mm_packus_epi16(__m128i a, __m128i b) {
+    return (__m128i)vcombine_u8(vqmovun_s16((int16x8_t)a), vqmovun_s16((int16x8_t)b));
+}
+inline __attribute__((always_inline)) __m128i _mm_unpacklo_epi64(__m128i a, __m128i b) {
+    return vcombine_s64(vget_low_s64(a), vget_low_s64(b));
+}
+inline __attribute__((always_inline)) __m128i _mm_unpackhi_epi64(__m128i a, __m128i b) {
+    return vcombine_s64(vget_high_s64(a), vget_high_s64(b));
+}
+inline __attribute__((always_inline)) __m128i _mm_blendv_epi8(__m128i a, __m128i b, __m128i mask) {
+    return (__m128i)vbslq_s8(vcltzq_s8((int8x16_t)mask), (int8x16_t)b, (int8x16_t)a);
+}
+inline __attribute__((always_inline)) __m128i _mm_blend_epi16(__m128i a, __m128i b, int imm) {
+    const uint16x8_t bits = { 1<<0, 1<<1, 1<<2, 1<<3, 1<<4, 1<<5, 1<<6, 1<<7 };
+    return (__m128i)vbslq_s16(vtstq_u16(vdupq_n_u16(imm), bits), (int16x8_t)b, (int16x8_t)a);
+}
+// the top bit of each byte, weighted by its position in the half, then summed per half
+inline __attribute__((always_inline)) int _mm_movemask_epi8(__m128i a) {
+    const int8x16_t pos = { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 };
+    uint8x16_t bits = vshlq_u8(vshrq_n_u8((uint8x16_t)a, 7), pos);
+    return vaddv_u8(vget_low_u8(bits)) | (vaddv_u8(vget_high_u8(bits)) << 8);
+}
+inline __attribute__((always_inline)) int _mm_testz_si128(__m128i a, __m128i b) {
+    return vmaxvq_u32((uint32x4_t)vandq_s64(a, b)) == 0;
+}
+#endif // SCHOKU_SIMD_NEON
+
+// the AVX2 types and intrinsics used by the solver, on the two 128-bit lanes.
+// (GCC's generic 32-byte vectors compile to scalar code for some operations without AVX)
+// Aligned as the AVX type, so that the layout of the GridState etc. stays the same.
+struct __attribute__((may_alias, aligned(32))) __m256i {
+    __m128i lo;
+    __m128i hi;
+};
+// for the unaligned loads and stores through a pointer
+struct __attribute__((packed, may_alias)) __m256i_u {
+    __m128i_u lo;
+    __m128i_u hi;
+    inline operator __m256i() const {
+        return { lo, hi };
+    }
+};
+// the elements, by value
+struct __v16hu {
+    unsigned short u16[16];
+    inline __v16hu(__m256i a) {
+        memcpy(u16, &a, sizeof(u16));
+    }
+    inline unsigned short operator[](int i) const {
+        return u16[i];
+    }
+};
+
+inline __attribute__((always_inline)) __m256i _mm256_setzero_si256() {
+    return { _mm_setzero_si128(), _mm_setzero_si128() };
+}
+// unaligned: the AVX2 code folds some loads of unaligned rows into the instructions
+inline __attribute__((always_inline)) __m256i _mm256_load_si256(const void *p) {
+    return { _mm_loadu_si128((const __m128i *)p), _mm_loadu_si128((const __m128i *)p + 1) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_loadu_si256(const void *p) {
+    return { _mm_loadu_si128((const __m128i *)p), _mm_loadu_si128((const __m128i *)p + 1) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_loadu2_m128i(const __m128i *hi, const __m128i *lo) {
+    return { _mm_loadu_si128(lo), _mm_loadu_si128(hi) };
+}
+inline __attribute__((always_inline)) void _mm256_store_si256(void *p, __m256i a) {
+    _mm_storeu_si128((__m128i *)p, a.lo);
+    _mm_storeu_si128((__m128i *)p + 1, a.hi);
+}
+inline __attribute__((always_inline)) void _mm256_storeu_si256(void *p, __m256i a) {
+    _mm_storeu_si128((__m128i *)p, a.lo);
+    _mm_storeu_si128((__m128i *)p + 1, a.hi);
+}
+inline __attribute__((always_inline)) __m256i _mm256_set_m128i(__m128i hi, __m128i lo) {
+    return { lo, hi };
+}
+inline __attribute__((always_inline)) __m128i _mm256_castsi256_si128(__m256i a) {
+    return a.lo;
+}
+inline __attribute__((always_inline)) __m128i _mm256_extractf128_si256(__m256i a, const int imm) {
+    return imm & 1 ? a.hi : a.lo;
+}
+inline __attribute__((always_inline)) __m256i _mm256_set1_epi8(char b) {
+    return { _mm_set1_epi8(b), _mm_set1_epi8(b) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_set1_epi16(short w) {
+    return { _mm_set1_epi16(w), _mm_set1_epi16(w) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_setr_epi8(char b0, char b1, char b2, char b3, char b4, char b5, char b6, char b7,
+                                                              char b8, char b9, char b10, char b11, char b12, char b13, char b14, char b15,
+                                                              char b16, char b17, char b18, char b19, char b20, char b21, char b22, char b23,
+                                                              char b24, char b25, char b26, char b27, char b28, char b29, char b30, char b31) {
+    return { _mm_setr_epi8(b0, b1, b2, b3, b4, b5, b6, b7, b8, b9, b10, b11, b12, b13, b14, b15),
+             _mm_setr_epi8(b16, b17, b18, b19, b20, b21, b22, b23, b24, b25, b26, b27, b28, b29, b30, b31) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_setr_epi16(short w0, short w1, short w2, short w3, short w4, short w5, short w6, short w7,
+                                                               short w8, short w9, short w10, short w11, short w12, short w13, short w14, short w15) {
+    return { _mm_setr_epi16(w0, w1, w2, w3, w4, w5, w6, w7), _mm_setr_epi16(w8, w9, w10, w11, w12, w13, w14, w15) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_set_epi16(short w15, short w14, short w13, short w12, short w11, short w10, short w9, short w8,
+                                                              short w7, short w6, short w5, short w4, short w3, short w2, short w1, short w0) {
+    return { _mm_set_epi16(w7, w6, w5, w4, w3, w2, w1, w0), _mm_set_epi16(w15, w14, w13, w12, w11, w10, w9, w8) };
+}
+
+// by lane
+#define SCHOKU_SIMD_BY_LANE(op256, op128) \
+inline __attribute__((always_inline)) __m256i op256(__m256i a, __m256i b) { \
+    return { op128(a.lo, b.lo), op128(a.hi, b.hi) }; \
+}
+SCHOKU_SIMD_BY_LANE(_mm256_and_si256, _mm_and_si128)
+SCHOKU_SIMD_BY_LANE(_mm256_or_si256, _mm_or_si128)
+SCHOKU_SIMD_BY_LANE(_mm256_xor_si256, _mm_xor_si128)
+SCHOKU_SIMD_BY_LANE(_mm256_andnot_si256, _mm_andnot_si128)
+SCHOKU_SIMD_BY_LANE(_mm256_cmpeq_epi8, _mm_cmpeq_epi8)
+SCHOKU_SIMD_BY_LANE(_mm256_cmpgt_epi8, _mm_cmpgt_epi8)
+SCHOKU_SIMD_BY_LANE(_mm256_cmpeq_epi16, _mm_cmpeq_epi16)
+SCHOKU_SIMD_BY_LANE(_mm256_cmpgt_epi16, _mm_cmpgt_epi16)
+SCHOKU_SIMD_BY_LANE(_mm256_add_epi8, _mm_add_epi8)
+SCHOKU_SIMD_BY_LANE(_mm256_sub_epi16, _mm_sub_epi16)
+SCHOKU_SIMD_BY_LANE(_mm256_shuffle_epi8, _mm_shuffle_epi8)
+SCHOKU_SIMD_BY_LANE(_mm256_packs_epi16, _mm_packs_epi16)
+SCHOKU_SIMD_BY_LANE(_mm256_packus_epi16, _mm_packus_epi16)
+#undef SCHOKU_SIMD_BY_LANE
+
+inline __attribute__((always_inline)) __m256i _mm256_srli_epi16(__m256i a, int n) {
+    return { _mm_srli_epi16(a.lo, n), _mm_srli_epi16(a.hi, n) };
+}
+inline __attribute__((always_inline)) __m256i _mm256_blendv_epi8(__m256i a, __m256i b, __m256i mask) {
+    return { _mm_blendv_epi8(a.lo, b.lo, mask.lo), _mm_blendv_epi8(a.hi, b.hi, mask.hi) };
+}
+inline __attribute__((always_inline)) int _mm256_testz_si256(__m256i a, __m256i b) {
+    return _mm_testz_si128(_mm_or_si128(_mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi)), _mm_set1_epi8(-1));
+}
+inline __attribute__((always_inline)) int _mm256_movemask_epi8(__m256i a) {
+    return (int)((unsigned int)_mm_movemask_epi8(a.lo) | ((unsigned int)_mm_movemask_epi8(a.hi) << 16));
+}
+// vpermq, in the solver 0xD8 (after a packs) and 0x99
+inline __attribute__((always_inline)) __m256i _mm256_permute4x64_epi64(__m256i a, const int imm) {
+    if ( imm == 0xD8 ) {
+        return { _mm_unpacklo_epi64(a.lo, a.hi), _mm_unpackhi_epi64(a.lo, a.hi) };
+    }
+    union { __m256i v; long long q[4]; } s = { a }, r;
+    for (int i = 0; i < 4; i++) {
+        r.q[i] = s.q[(imm >> (2*i)) & 3];
+    }
+    return r.v;
+}
+// vperm2i128
+inline __attribute__((always_inline)) __m128i schoku_select_lane(__m256i a, __m256i b, const int imm) {
+    return (imm & 8) ? _mm_setzero_si128() : (imm & 2) ? ((imm & 1) ? b.hi : b.lo) : ((imm & 1) ? a.hi : a.lo);
+}
+inline __attribute__((always_inline)) __m256i _mm256_permute2x128_si256(__m256i a, __m256i b, const int imm) {
+    return { schoku_select_lane(a, b, imm), schoku_select_lane(a, b, imm >> 4) };
+}
+// the immediates of the byte shifts, the blend and the lane accesses are passed on as such
+#define _mm256_bsrli_epi128(a, n) ({ const __m256i a_ = (a); \
+    (__m256i){ _mm_srli_si128(a_.lo, (n)), _mm_srli_si128(a_.hi, (n)) }; })
+#define _mm256_alignr_epi8(a, b, n) ({ const __m256i a_ = (a), b_ = (b); \
+    (__m256i){ _mm_alignr_epi8(a_.lo, b_.lo, (n)), _mm_alignr_epi8(a_.hi, b_.hi, (n)) }; })
+#define _mm256_blend_epi16(a, b, imm) ({ const __m256i a_ = (a), b_ = (b); \
+    (__m256i){ _mm_blend_epi16(a_.lo, b_.lo, (imm)), _mm_blend_epi16(a_.hi, b_.hi, (imm)) }; })
+#define _mm256_extract_epi16(a, i) _mm_extract_epi16((i) & 8 ? (a).hi : (a).lo, (i) & 7)
+#define _mm256_extract_epi64(a, i) _mm_extract_epi64((i) & 2 ? (a).hi : (a).lo, (i) & 1)
+#define _mm256_insert_epi16(a, w, i) ({ __m256i a_ = (a); \
+    if ( (i) & 8 ) { a_.hi = _mm_insert_epi16(a_.hi, (w), (i) & 7); } else { a_.lo = _mm_insert_epi16(a_.lo, (w), (i) & 7); } \
+    a_; })
+
+// BMI1, BMI2, LZCNT and POPCNT
+inline __attribute__((always_inline)) unsigned int _tzcnt_u32(unsigned int x) {
+    return x ? __builtin_ctz(x) : 32;
+}
+inline __attribute__((always_inline)) unsigned long long _tzcnt_u64(unsigned long long x) {
+    return x ? __builtin_ctzll(x) : 64;
+}
+inline __attribute__((always_inline)) unsigned long long _lzcnt_u64(unsigned long long x) {
+    return x ? __builtin_clzll(x) : 64;
+}
+inline __attribute__((always_inline)) unsigned short __lzcnt16(unsigned short x) {
+    return x ? __builtin_clz(x) - 16 : 16;
+}
+#define __tzcnt_u32 _tzcnt_u32
+#define __tzcnt_u64 _tzcnt_u64
+inline __attribute__((always_inline)) unsigned int _blsr_u32(unsigned int x) {
+    return x & (x - 1);
+}
+inline __attribute__((always_inline)) unsigned long long _blsr_u64(unsigned long long x) {
+    return x & (x - 1);
+}
+inline __attribute__((always_inline)) int _popcnt32(int x) {
+    return __builtin_popcount(x);
+}
+inline __attribute__((always_inline)) int _popcnt64(long long x) {
+    return __builtin_popcountll(x);
+}
+inline __attribute__((always_inline)) unsigned short __popcnt16(unsigned short x) {
+    return __builtin_popcount(x);
+}
+inline __attribute__((always_inline)) unsigned int __popcnt(unsigned int x) {
+    return __builtin_popcount(x);
+}
+inline __attribute__((always_inline)) unsigned long long __popcnt64(unsigned long long x) {
+    return __builtin_popcountll(x);
+}
+inline unsigned long long _pext_u64(unsigned long long x, unsigned long long mask) {
+    unsigned long long res = 0;
+    for (unsigned long long bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+        if ( x & mask & -mask ) {
+            res |= bit;
+        }
+    }
+    return res;
+}
+inline unsigned long long _pdep_u64(unsigned long long x, unsigned long long mask) {
+    unsigned long long res = 0;
+    for (unsigned long long bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+        if ( x & bit ) {
+            res |= mask & -mask;
+        }
+    }
+    return res;
+}
+inline unsigned int _pext_u32(unsigned int x, unsigned int mask) {
+    return (unsigned int)_pext_u64(x, mask);
+}
+inline unsigned int _pdep_u32(unsigned int x, unsigned int mask) {
+    return (unsigned int)_pdep_u64(x, mask);
+}
+inline __attribute__((always_inline)) unsigned char _bittestandreset64(long long *a, long long b) {
+    unsigned char r = (*a >> b) & 1;
+    *a &= ~(1LL << b);
+    return r;
+}
+
+// the time stamp counter (OPT_PHASE_STATS)
+inline __attribute__((always_inline)) unsigned long long __rdtsc() {
+#ifdef SCHOKU_SIMD_NEON
+    unsigned long long t;
+    asm volatile("mrs %0, cntvct_el0" : "=r" (t));
+    return t;
+#else
+    return __builtin_ia32_rdtsc();
+#endif
+}
+
+#endif // SCHOKU_SIMD_AVX2
+
+#endif // SCHOKU_SIMD_H